@@ -0,0 +1,298 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "pmt.h"
+
+extern char** environ;
+
+using namespace std;
+using namespace pcm;
+
+// Saturation alerts checked on every interval's values as soon as they are
+// computed, no csv tailing. One rule per --alert (';' separated) or per line
+// of --alert-file:
+//   S*Read>85% peak=120000 for=3 cooldown=60 do=exec:/usr/local/bin/page
+//   3b:00.0_IBW>10G clear=8G do=fifo:/run/pmt-alerts do=log
+// The metric is a column, a '*' pattern or a column suffix such as a
+// device's "3b:00.0_IBW"; every matching column keeps its own state. Values
+// are in the column's unit (MB/s), K/G scale by 1000, a % is of peak=.
+// A rule fires after for= intervals past the threshold and resolves once the
+// value is back past clear= (10% inside the threshold by default), so a value
+// sitting on the threshold doesn't flap. cooldown= seconds must pass between
+// two firings of a column. Actions see both the firing and the resolve:
+//   log            a line on stderr, log:<file> appends it to a file
+//   exec:<cmd>     /bin/sh -c <cmd> in the background, PMT_ALERT_* set
+//   fifo:<path>    the line written non-blocking, dropped when nobody reads
+enum { ACTION_LOG, ACTION_EXEC, ACTION_FIFO };
+
+struct alert_action{
+    int kind;
+    string arg;
+};
+
+struct alert_rule{
+    string text, metric;
+    bool above;
+    double threshold, clear;    // % of peak when pct
+    bool pct, clear_pct;
+    double peak;
+    int for_n;
+    double cooldown;
+    vector<alert_action> actions;
+};
+
+struct alert_state{
+    size_t rule;
+    int idx;
+    int count;
+    bool firing, notified;
+    bool fired_once;
+    std::chrono::steady_clock::time_point last_fire;
+};
+
+static vector<alert_rule> rules;
+static vector<alert_state> states;
+static vector<string> alert_names;
+
+void add_alert_options(cxxopts::Options& options){
+    options.add_options("alert")
+        ("alert",      "Alert rules, ';' separated: metric>value[%] [peak=] [for=] [clear=] [cooldown=] [do=log|exec:cmd|fifo:path]", cxxopts::value<string>()->default_value(""))
+        ("alert-file", "Alert rules, one per line, # comments", cxxopts::value<string>()->default_value(""))
+    ;
+}
+
+// "85%", "10G", "500K", "8000"
+static double parse_value(const string& s, bool& pct){
+    char* end = NULL;
+    double v = strtod(s.c_str(), &end);
+    pct = false;
+    if (end && *end == '%') pct = true;
+    else if (end && (*end == 'G' || *end == 'g')) v *= 1000;
+    else if (end && (*end == 'K' || *end == 'k')) v /= 1000;
+    return v;
+}
+
+static void parse_rule(const string& text, const vector<string>& columns){
+    stringstream ss(text);
+    string head, tok;
+    ss >> head;
+    const size_t op = head.find_first_of("<>");
+    if (op == string::npos || op == 0 || op + 1 >= head.size()){
+        cerr << "alert: expected metric>value or metric<value, got " << text << endl;
+        exit(EXIT_FAILURE);
+    }
+    alert_rule r;
+    r.text = text.substr(text.find_first_not_of(" \t"));
+    r.metric = head.substr(0, op);
+    r.above = head[op] == '>';
+    r.threshold = parse_value(head.substr(op + 1), r.pct);
+    r.clear = r.threshold * (r.above ? 0.9 : 1.1);
+    r.clear_pct = r.pct;
+    r.peak = 0;
+    r.for_n = 1;
+    r.cooldown = 60;
+    // exec commands keep their spaces: words up to the next key are theirs
+    vector<string> toks;
+    while (ss >> tok){
+        const string key = tok.substr(0, tok.find('='));
+        const bool is_key = tok.find('=') != string::npos &&
+            (key == "for" || key == "peak" || key == "clear" || key == "cooldown" || key == "do");
+        if (!is_key && toks.size() && toks.back().compare(0, 8, "do=exec:") == 0)
+            toks.back() += " " + tok;
+        else
+            toks.push_back(tok);
+    }
+    for (auto t = toks.cbegin(); t != toks.cend(); ++t){
+        const size_t eq = t->find('=');
+        const string key = t->substr(0, eq), val = eq == string::npos ? "" : t->substr(eq + 1);
+        bool unused;
+        if (key == "for") r.for_n = (std::max)(1, atoi(val.c_str()));
+        else if (key == "peak") r.peak = parse_value(val, unused);
+        else if (key == "clear") r.clear = parse_value(val, r.clear_pct);
+        else if (key == "cooldown") r.cooldown = atof(val.c_str());
+        else if (key == "do"){
+            alert_action a;
+            const size_t colon = val.find(':');
+            const string kind = val.substr(0, colon);
+            a.arg = colon == string::npos ? "" : val.substr(colon + 1);
+            if (kind == "log") a.kind = ACTION_LOG;
+            else if (kind == "exec" && a.arg.size()) a.kind = ACTION_EXEC;
+            else if (kind == "fifo" && a.arg.size()) a.kind = ACTION_FIFO;
+            else{
+                cerr << "alert: unknown action " << val << " in " << text << endl;
+                exit(EXIT_FAILURE);
+            }
+            r.actions.push_back(a);
+        }else{
+            cerr << "alert: unknown key " << key << " in " << text << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((r.pct || r.clear_pct) && r.peak <= 0){
+        cerr << "alert: a % threshold needs peak=<value> in " << text << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (r.actions.empty()){
+        alert_action a;
+        a.kind = ACTION_LOG;
+        r.actions.push_back(a);
+    }
+    for (auto a = r.actions.cbegin(); a != r.actions.cend(); ++a){
+        if (a->kind != ACTION_FIFO) continue;
+        if (mkfifo(a->arg.c_str(), 0644) != 0 && errno != EEXIST){
+            cerr << "alert: can't create fifo " << a->arg << ": " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    const bool glob = r.metric.find_first_of("*?[") != string::npos;
+    size_t matched = 0;
+    for (size_t i = 0; i < columns.size(); i++){
+        const string& c = columns[i];
+        const bool hit = glob ? fnmatch(r.metric.c_str(), c.c_str(), 0) == 0
+                              : c == r.metric || (c.size() > r.metric.size() && c.compare(c.size() - r.metric.size(), string::npos, r.metric) == 0
+                                                  && c[c.size() - r.metric.size() - 1] == '_');
+        if (!hit) continue;
+        alert_state s;
+        s.rule = rules.size();
+        s.idx = (int)i;
+        s.count = 0;
+        s.firing = s.notified = s.fired_once = false;
+        states.push_back(s);
+        matched++;
+    }
+    if (matched == 0){
+        cerr << "alert: unknown metric " << r.metric << endl;
+        exit(EXIT_FAILURE);
+    }
+    rules.push_back(r);
+}
+
+void alert_setup(const cxxopts::ParseResult& result, const vector<string>& columns){
+    rules.clear();
+    states.clear();
+    alert_names = columns;
+    stringstream ss(result["alert"].as<string>());
+    string line;
+    while (getline(ss, line, ';'))
+        if (line.find_first_not_of(" \t") != string::npos) parse_rule(line, columns);
+    const string file = result["alert-file"].as<string>();
+    if (file.empty()) return;
+    std::ifstream in(file.c_str());
+    if (!in.is_open()){
+        cerr << "alert: can't open " << file << endl;
+        exit(EXIT_FAILURE);
+    }
+    while (getline(in, line)){
+        const size_t p = line.find_first_not_of(" \t");
+        if (p == string::npos || line[p] == '#') continue;
+        parse_rule(line.substr(p), columns);
+    }
+}
+
+static void run_command(const string& cmd, const char* state, const string& metric, double value, double threshold, const string& rule){
+    // the environment is built before fork(), the child only execs
+    vector<string> env;
+    for (char** e = environ; *e; ++e)
+        if (strncmp(*e, "PMT_ALERT_", 10) != 0) env.push_back(*e);
+    char buf[64];
+    env.push_back(string("PMT_ALERT_STATE=") + state);
+    env.push_back("PMT_ALERT_METRIC=" + metric);
+    snprintf(buf, sizeof(buf), "PMT_ALERT_VALUE=%.2f", value);
+    env.push_back(buf);
+    snprintf(buf, sizeof(buf), "PMT_ALERT_THRESHOLD=%.2f", threshold);
+    env.push_back(buf);
+    env.push_back("PMT_ALERT_RULE=" + rule);
+    vector<char*> envp;
+    for (auto e = env.begin(); e != env.end(); ++e)
+        envp.push_back(&(*e)[0]);
+    envp.push_back(NULL);
+    const char* argv[] = {"sh", "-c", cmd.c_str(), NULL};
+
+    const pid_t pid = fork();
+    if (pid == 0){
+        setsid();
+        execve("/bin/sh", (char* const*)argv, envp.data());
+        _exit(127);
+    }
+    if (pid < 0)
+        cerr << "alert: can't fork for " << cmd << ": " << strerror(errno) << endl;
+}
+
+static void notify(const alert_rule& r, const char* state, const string& metric, double value, double threshold){
+    char buf[64];
+    snprintf(buf, sizeof(buf), " %s=%.2f threshold=%.2f ", metric.c_str(), value, threshold);
+    const string line = currentDateTime() + " " + state + buf + r.text + "\n";
+    for (auto a = r.actions.cbegin(); a != r.actions.cend(); ++a){
+        if (a->kind == ACTION_LOG){
+            if (a->arg.empty()){
+                cerr << line << flush;
+            }else{
+                std::ofstream out(a->arg.c_str(), std::ios_base::app);
+                out << line;
+            }
+        }else if (a->kind == ACTION_EXEC){
+            run_command(a->arg, state, metric, value, threshold, r.text);
+        }else{
+            const int fd = open(a->arg.c_str(), O_WRONLY | O_NONBLOCK);
+            if (fd < 0){
+                if (DEBUG) cerr << "alert: no reader on " << a->arg << ", dropped" << endl;
+                continue;
+            }
+            if (write(fd, line.data(), line.size()) != (ssize_t)line.size() && DEBUG)
+                cerr << "alert: short write to " << a->arg << endl;
+            close(fd);
+        }
+    }
+}
+
+// evaluate every rule against one interval, in the columns given to alert_setup()
+void alert_check(const vector<double>& values){
+    if (states.empty()) return;
+    while (waitpid(-1, NULL, WNOHANG) > 0){}     // exec actions that finished
+    const auto now = std::chrono::steady_clock::now();
+    for (auto s = states.begin(); s != states.end(); ++s){
+        if (s->idx >= (int)values.size()) continue;
+        const alert_rule& r = rules[s->rule];
+        const double v = values[s->idx];
+        const double threshold = r.pct ? r.threshold / 100 * r.peak : r.threshold;
+        const double clear = r.clear_pct ? r.clear / 100 * r.peak : r.clear;
+        if (!s->firing){
+            const bool over = r.above ? v > threshold : v < threshold;
+            s->count = over ? s->count + 1 : 0;
+            if (s->count < r.for_n) continue;
+            s->firing = true;
+            const double since = std::chrono::duration<double>(now - s->last_fire).count();
+            s->notified = !s->fired_once || since >= r.cooldown;
+            if (s->notified){
+                s->fired_once = true;
+                s->last_fire = now;
+                notify(r, "ALERT", alert_names[s->idx], v, threshold);
+            }else if (DEBUG){
+                cerr << "alert: " << alert_names[s->idx] << " in cooldown, not notified" << endl;
+            }
+        }else if (r.above ? v < clear : v > clear){
+            s->firing = false;
+            s->count = 0;
+            if (s->notified)
+                notify(r, "RESOLVED", alert_names[s->idx], v, clear);
+        }
+    }
+}
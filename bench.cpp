@@ -0,0 +1,226 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Hot path microbenchmarks on synthetic data, built as its own binary by
+// static.sh so the counting operator new below never ships in pmt.
+// One csv line per benchmark on stdout:
+//   bench,ops,ns_op,allocs_op,bytes_op
+static uint64 alloc_count = 0, alloc_bytes = 0;
+
+void* operator new(size_t n){
+    alloc_count++;
+    alloc_bytes += n;
+    void* p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+// everything the tools print during a benchmark goes here
+struct null_buf : std::streambuf {
+    int overflow(int c){ return c; }
+    std::streamsize xsputn(const char*, std::streamsize n){ return n; }
+};
+
+static double min_ms = 200;
+static string filter;
+
+template <typename F>
+static void bench(const char* name, F f){
+    if (filter.size() && string(name).find(filter) == string::npos) return;
+    f();
+    uint64 ops = 1;
+    for (;;){
+        const uint64 a0 = alloc_count, b0 = alloc_bytes;
+        auto t0 = std::chrono::steady_clock::now();
+        for (uint64 i = 0; i < ops; i++)
+            f();
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        if (ns >= min_ms * 1000000 || ops >= (1ULL << 40)){
+            printf("%s,%llu,%.1f,%.2f,%.1f\n", name, (unsigned long long)ops, ns / ops,
+                   (double)(alloc_count - a0) / ops, (double)(alloc_bytes - b0) / ops);
+            fflush(stdout);
+            return;
+        }
+        // aim a bit past the target instead of doubling from 1 every time
+        const double want = min_ms * 1000000 * 1.2 / (ns > 0 ? ns / ops : 1);
+        ops = (uint64)(std::min)((double)ops * 100, (std::max)((double)ops * 2, want));
+    }
+}
+
+static const char* h_names[4] = {"IB write", "IB read", "OB read", "OB write"};
+
+// same shape as opCode-<model>.txt: 4 directions x 8 bifurcated parts
+static string write_events_file(){
+    char path[] = "/tmp/pmt-bench-events-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0){
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    static const int ev_sel[4] = {0x83, 0x83, 0xc0, 0xc0};
+    static const int umask[4] = {0x1, 0x4, 0x4, 0x1};
+    std::ofstream out(path);
+    out << "# synthetic iio events\n";
+    char buf[256];
+    for (int h = 0; h < 4; h++)
+        for (int part = 0; part < 8; part++){
+            snprintf(buf, sizeof(buf), "ctr=%d,ev_sel=0x%x,umask=0x%x,ch_mask=0x%02x,fc_mask=0x07,multiplier=4,divider=1,hname=%s,vname=Part%d",
+                     h, ev_sel[h], umask[h], 1 << part, h_names[h], part);
+            out << buf << "\n";
+        }
+    return path;
+}
+
+// pcie_save_topology() lines for sockets x 6 stacks x 8 parts x devices
+static vector<string> synthetic_topology(uint32 sockets, uint32 devices){
+    vector<string> lines;
+    char buf[256];
+    for (int h = 0; h < 4; h++)
+        for (int part = 0; part < 8; part++){
+            snprintf(buf, sizeof(buf), "event %d %d %d 4 1 %s\tPart%d", h, part, h, h_names[h], part);
+            lines.push_back(buf);
+        }
+    for (uint32 s = 0; s < sockets; s++){
+        lines.push_back("socket " + std::to_string(s));
+        for (int stack = 0; stack < 6; stack++){
+            const int busno = (s * 0x80 + stack * 0x14) & 0xff;
+            snprintf(buf, sizeof(buf), "stack %d %d Stack %d", stack, busno, stack);
+            lines.push_back(buf);
+            for (int part = 0; part < 8; part++){
+                lines.push_back("part " + std::to_string(part));
+                snprintf(buf, sizeof(buf), "root %d 2 %d 32902 13434 1 4 16", busno, part);
+                lines.push_back(buf);
+                for (uint32 d = 0; d < devices; d++){
+                    snprintf(buf, sizeof(buf), "pci %d %d 0 5555 4125 0 4 16", (busno + 1 + part) & 0xff, d & 31);
+                    lines.push_back(buf);
+                }
+            }
+        }
+    }
+    return lines;
+}
+
+int bench_main(int argc, char** argv) {
+    cxxopts::Options options("bench", "time the tool's hot paths on synthetic data");
+    options.add_options()
+        ("e,events",  "opCode file for load_events, synthetic if empty", cxxopts::value<string>()->default_value(""))
+        ("t,topology","pcie_save_topology() fixture (a record header works), synthetic if empty", cxxopts::value<string>()->default_value(""))
+        ("sockets",   "Sockets in the synthetic topology (max 4)", cxxopts::value<int>()->default_value("4"))
+        ("devices",   "Devices per bifurcated part in the synthetic topology", cxxopts::value<int>()->default_value("8"))
+        ("channels",  "Memory channels per socket", cxxopts::value<int>()->default_value("8"))
+        ("ms",        "Minimum milliseconds per benchmark", cxxopts::value<double>()->default_value("200"))
+        ("isa",       "Rate kernels: auto, scalar, avx2 or avx512", cxxopts::value<string>()->default_value("auto"))
+        ("f,filter",  "Only benchmarks whose name contains this", cxxopts::value<string>()->default_value(""))
+        ("h,help",    "Print usage")
+    ;
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    min_ms = result["ms"].as<double>();
+    filter = result["filter"].as<string>();
+    if (!rate_force_isa(result["isa"].as<string>())){
+        cerr << "bench: this cpu can't run the " << result["isa"].as<string>() << " rate kernels" << endl;
+        exit(EXIT_FAILURE);
+    }
+    cerr << "rate kernels: " << rate_isa() << endl;
+    const uint32 sockets = (uint32)(std::min)(4, (std::max)(1, result["sockets"].as<int>()));
+    const uint32 devices = (uint32)(std::max)(0, result["devices"].as<int>());
+    const uint32 channels = (uint32)(std::max)(1, result["channels"].as<int>());
+
+    vector<string> topology;
+    const string topology_file = result["topology"].as<string>();
+    if (topology_file.empty()){
+        topology = synthetic_topology(sockets, devices);
+    }else{
+        std::ifstream in(topology_file.c_str());
+        if (!in.is_open()){
+            cerr << "bench: can't open " << topology_file << endl;
+            exit(EXIT_FAILURE);
+        }
+        string line;
+        while (getline(in, line) && line != "data")
+            topology.push_back(line);
+    }
+
+    null_buf nb;
+    std::ostream null_out(&nb);
+    std::streambuf* cout_buf = std::cout.rdbuf(&nb);
+    printf("bench,ops,ns_op,allocs_op,bytes_op\n");
+
+    if (filter.empty() || string("load_events").find(filter) != string::npos){
+        string events = result["events"].as<string>();
+        const bool synthetic = events.empty();
+        if (synthetic)
+            events = write_events_file();
+        bench("load_events", [&](){ pcie_load_events(events); });
+        if (synthetic)
+            unlink(events.c_str());
+    }
+
+    bench("topology", [&](){
+        pcie_clear_topology();
+        for (auto l = topology.cbegin(); l != topology.cend(); ++l)
+            pcie_load_topology(*l);
+    });
+    pcie_clear_topology();
+    for (auto l = topology.cbegin(); l != topology.cend(); ++l)
+        pcie_load_topology(*l);
+
+    // what get_IIO_Samples() does once the counters are read
+    vector<uint64> raw(pcie_raw_size());
+    for (size_t i = 0; i < raw.size(); i++)
+        raw[i] = 1000003ULL * (i + 1);
+    bench("iio_rate", [&](){ pcie_replay(raw, 250); });
+    pcie_replay(raw, 250);
+    bench("build_csv", [&](){ pcie_write_csv(null_out); });
+    bench("build_display", [&](){ pcie_write_display(null_out); });
+    vector<double> values;
+    values.reserve(4096);
+    bench("pcie_values", [&](){ values.clear(); pcie_values(values); });
+
+    SHOW_MEMORY = true;
+    SHOW_CHANNELS = true;
+    mem_setup(channels);
+    vector<uint64> reads(sockets * channels), writes(sockets * channels);
+    for (size_t i = 0; i < reads.size(); i++){
+        reads[i] = 15625000ULL * (i + 1);
+        writes[i] = 7812500ULL * (i + 1);
+    }
+    bench("mem_rates", [&](){ values.clear(); mem_rates(sockets, reads, writes, 1000, values); });
+    imc_state before, after;
+    before.reads.assign(reads.size(), 0);
+    before.writes.assign(reads.size(), 0);
+    after.reads = reads;
+    after.writes = writes;
+    bench("imc_deltas", [&](){ imc_deltas(before, after, reads, writes); });
+    bench("printMemBW", [&](){ printMemBW(sockets, before, after, 1000, values); });
+    delay = 1;
+    bench("currentDateTime", [&](){ currentDateTime(); });
+    delay = 0.1f;
+    bench("currentDateTime_ms", [&](){ currentDateTime(); });
+
+    std::cout.rdbuf(cout_buf);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,175 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <stdio.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Which cores drive the bandwidth printMemBW reports: per core IPC, L3 misses
+// and local/remote DRAM traffic, read by one thread per socket. Rows are long
+// format so a 224 thread host stays readable: every socket, then only the
+// --top busiest cores of the interval.
+//   Time,Where,IPC,L3MissM,LocalMB,RemoteMB
+struct core_row{
+    string where;
+    double ipc, misses, local, remote;
+};
+
+static vector<vector<uint32>> socket_cores;   // online cores of each socket
+
+static void read_socket(PCM *m, uint32 socket, vector<CoreCounterState>& states){
+    const vector<uint32>& cores = socket_cores[socket];
+    for (auto c = cores.cbegin(); c != cores.cend(); ++c)
+        states[*c] = m->getCoreCounterState(*c);
+}
+
+static void read_cores(PCM *m, vector<CoreCounterState>& states){
+    vector<std::thread> threads;
+    for (uint32 s = 1; s < socket_cores.size(); ++s)
+        threads.push_back(std::thread(read_socket, m, s, std::ref(states)));
+    read_socket(m, 0, states);
+    for (auto t = threads.begin(); t != threads.end(); ++t)
+        t->join();
+}
+
+static void write_row(std::ostream& out, const string& time, const core_row& r, bool csv){
+    char buf[128];
+    snprintf(buf, sizeof(buf), csv ? "%s,%s,%.2f,%.2f,%.2f,%.2f\n" : "%s    %-8s %6.2f %10.2f %10.2f %10.2f\n",
+             time.c_str(), r.where.c_str(), r.ipc, r.misses, r.local, r.remote);
+    out << buf;
+}
+
+int core_main(int argc, char** argv) {
+    cxxopts::Options options("core", "per core IPC, L3 misses and DRAM traffic, top N cores");
+    options.add_options()
+        ("g,debug",   "Enable debug info",    cxxopts::value<bool>()->default_value("false"))
+        ("o,output",  "Write to csv file",    cxxopts::value<string>()->default_value(""))
+        ("s,delay",   "Seconds/update",       cxxopts::value<float>()->default_value("1.0"))
+        ("k,top",     "Cores shown per interval, 0 shows all", cxxopts::value<int>()->default_value("10"))
+        ("by",        "Rank cores by bw (local+remote), remote, miss or ipc", cxxopts::value<string>()->default_value("bw"))
+        ("h,help",    "Print usage")
+    ;
+    add_run_options(options);
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    DEBUG = result["debug"].as<bool>();
+    OUT_FILE = result["output"].as<string>();
+    delay = result["delay"].as<float>();
+    const int top = (std::max)(0, result["top"].as<int>());
+    const string by = result["by"].as<string>();
+    if (by != "bw" && by != "remote" && by != "miss" && by != "ipc"){
+        cerr << "core: --by takes bw, remote, miss or ipc" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    PCM *m = PCM::getInstance();
+    PCM::ErrorCode returnResult = m->program();
+    if (returnResult != PCM::Success) {
+        std::cerr << "PCM couldn't start" << std::endl;
+        std::cerr << "Error code: " << returnResult << std::endl;
+        exit(1);
+    }
+    if (!m->CoreLocalMemoryBWMetricAvailable() || !m->CoreRemoteMemoryBWMetricAvailable())
+        cerr << "core: no per core memory bandwidth (RDT MBM) on this cpu, LocalMB/RemoteMB stay 0" << endl;
+
+    const uint32 numSockets = m->getNumSockets();
+    const uint32 numCores = m->getNumCores();
+    socket_cores.assign(numSockets, vector<uint32>());
+    for (uint32 c = 0; c < numCores; ++c)
+        if (m->isCoreOnline((int32)c) && (uint32)m->getSocketId(c) < numSockets)
+            socket_cores[m->getSocketId(c)].push_back(c);
+
+    std::ofstream file_stream;
+    std::ostream* OUT = &std::cout;
+    if (OUT_FILE.size()>0) {
+        file_stream.open(OUT_FILE.c_str(), std::ios_base::out);
+        OUT = &file_stream;
+    }
+    const bool csv = OUT_FILE.size()>0;
+    *OUT << (csv ? "Time,Where,IPC,L3MissM,LocalMB,RemoteMB\n" : "Time        Where       IPC    L3MissM    LocalMB   RemoteMB\n");
+
+    vector<CoreCounterState> before(numCores), after(numCores);
+    vector<core_row> rows;
+    vector<double> values(numSockets * 4);
+    rows.reserve(numCores);
+    run_setup(result);
+    read_cores(m, before);
+    uint64 beforeTime = m->getTickCount();
+    for (;;){
+        MySleepMs(int(delay * 1000));
+        read_cores(m, after);
+        const uint64 afterTime = m->getTickCount();
+        const double seconds = (afterTime - beforeTime) / 1000.0;
+        const string time = currentDateTime();
+
+        rows.clear();
+        for (uint32 s = 0; s < numSockets; ++s){
+            uint64 instr = 0, cycles = 0;
+            double misses = 0, local = 0, remote = 0;
+            for (auto c = socket_cores[s].cbegin(); c != socket_cores[s].cend(); ++c){
+                core_row r;
+                r.where = "S" + std::to_string(s) + "C" + std::to_string(*c);
+                r.ipc = getIPC(before[*c], after[*c]);
+                r.misses = getL3CacheMisses(before[*c], after[*c]) / 1000000.0 / seconds;
+                r.local = getLocalMemoryBW(before[*c], after[*c]) / 1000000.0 / seconds;
+                r.remote = getRemoteMemoryBW(before[*c], after[*c]) / 1000000.0 / seconds;
+                instr += getInstructionsRetired(before[*c], after[*c]);
+                cycles += getCycles(before[*c], after[*c]);
+                misses += r.misses;
+                local += r.local;
+                remote += r.remote;
+                rows.push_back(r);
+            }
+            core_row total;
+            total.where = "S" + std::to_string(s);
+            total.ipc = cycles ? (double)instr / cycles : 0;
+            total.misses = misses;
+            total.local = local;
+            total.remote = remote;
+            write_row(*OUT, time, total, csv);
+            values[s * 4 + 0] = total.ipc;
+            values[s * 4 + 1] = misses;
+            values[s * 4 + 2] = local;
+            values[s * 4 + 3] = remote;
+        }
+
+        const size_t n = top > 0 ? (std::min)((size_t)top, rows.size()) : rows.size();
+        auto key = [&by](const core_row& r) -> double {
+            if (by == "remote") return r.remote;
+            if (by == "miss") return r.misses;
+            if (by == "ipc") return r.ipc;
+            return r.local + r.remote;
+        };
+        std::partial_sort(rows.begin(), rows.begin() + n, rows.end(),
+                          [&key](const core_row& a, const core_row& b){ return key(a) > key(b); });
+        for (size_t i = 0; i < n; i++)
+            write_row(*OUT, time, rows[i], csv);
+        OUT->flush();
+
+        swap(before, after);
+        beforeTime = afterTime;
+        if (!run_continue(values)) break;
+    }
+
+    file_stream.close();
+    vector<string> columns;
+    for (uint32 s = 0; s < numSockets; ++s){
+        columns.push_back("S" + std::to_string(s) + "IPC");
+        columns.push_back("S" + std::to_string(s) + "L3MissM");
+        columns.push_back("S" + std::to_string(s) + "LocalMB");
+        columns.push_back("S" + std::to_string(s) + "RemoteMB");
+    }
+    run_summary(columns);
+    m->cleanup();
+    exit(EXIT_SUCCESS);
+}
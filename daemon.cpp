@@ -0,0 +1,345 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// One collector, many subscribers. The collector samples at the finest interval
+// any subscriber asked for; each subscriber gets its own stream averaged from
+// those base samples. Protocol, one request line per connection:
+//   LIST                          -> comma separated metric names
+//   SUBSCRIBE <ms> [m1,m2,...]    -> "Time,m1,m2" header then one csv row per <ms>
+struct subscriber{
+    int fd;
+    string in;
+    bool eof;               // peer shut its write side: no more requests
+    bool subscribed;
+    uint64 interval_ms;
+    vector<int> idx;        // columns picked from the base sample
+    vector<double> acc;     // value * ms accumulated since the last row
+    uint64 acc_ms;
+};
+
+static vector<subscriber> subs;
+static vector<string> columns;
+static uint64 min_interval_ms = 100;
+static int listen_fd = -1;
+
+static bool send_line(subscriber& s, const string& line){
+    // a subscriber that can't keep up is dropped rather than stalling the collector
+    ssize_t n = send(s.fd, line.data(), line.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    return n == (ssize_t)line.size();
+}
+
+static bool handle_request(subscriber& s, const string& line){
+    istringstream iss(line);
+    string cmd, metrics;
+    iss >> cmd;
+    if (cmd == "LIST"){
+        string out;
+        for (auto c = columns.cbegin(); c != columns.cend(); ++c)
+            out += (out.empty() ? "" : ",") + *c;
+        return send_line(s, out + "\n");
+    }
+    if (cmd != "SUBSCRIBE"){
+        send_line(s, "ERR unknown command " + cmd + "\n");
+        return false;
+    }
+    uint64 ms = 0;
+    iss >> ms >> metrics;
+    if (ms < min_interval_ms){
+        send_line(s, "ERR interval below " + std::to_string(min_interval_ms) + " ms\n");
+        return false;
+    }
+    s.idx.clear();
+    if (metrics.empty() || metrics == "all"){
+        for (size_t i = 0; i < columns.size(); i++)
+            s.idx.push_back((int)i);
+    }else{
+        stringstream ss(metrics);
+        string name;
+        while (getline(ss, name, ',')) {
+            auto it = std::find(columns.begin(), columns.end(), name);
+            if (it == columns.end()){
+                send_line(s, "ERR unknown metric " + name + "\n");
+                return false;
+            }
+            s.idx.push_back((int)(it - columns.begin()));
+        }
+    }
+    s.subscribed = true;
+    s.interval_ms = ms;
+    s.acc.assign(s.idx.size(), 0.0);
+    s.acc_ms = 0;
+    string header = "Time";
+    for (size_t i = 0; i < s.idx.size(); i++)
+        header += "," + columns[s.idx[i]];
+    return send_line(s, header + "\n");
+}
+
+// EOF only ends the requests (socat, nc -N send theirs and shut down the
+// write side): a subscriber is kept and streamed to until a send fails
+static bool handle_input(subscriber& s){
+    char buf[512];
+    ssize_t n = recv(s.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (n == 0){
+        s.eof = true;
+        if (s.in.find_first_not_of(" \r") != string::npos && !handle_request(s, s.in))
+            return false;
+        s.in.clear();
+        return s.subscribed;
+    }
+    s.in.append(buf, n);
+    size_t pos;
+    while ((pos = s.in.find('\n')) != string::npos) {
+        string line = s.in.substr(0, pos);
+        s.in.erase(0, pos + 1);
+        if (line.size() && line[line.size()-1] == '\r')
+            line.erase(line.size()-1);
+        if (line.empty()) continue;
+        if (!handle_request(s, line))
+            return false;
+    }
+    return s.in.size() < 4096;
+}
+
+// fold one base sample into each subscriber, emit rows that are due
+static void publish(const vector<double>& values, uint64 elapsed, const string& now, uint64 base_ms){
+    for (auto s = subs.begin(); s != subs.end(); ) {
+        bool ok = true;
+        if (s->subscribed){
+            for (size_t i = 0; i < s->idx.size(); i++)
+                s->acc[i] += values[s->idx[i]] * elapsed;
+            s->acc_ms += elapsed;
+            if (s->acc_ms + base_ms / 2 >= s->interval_ms && s->acc_ms > 0){
+                string row = now;
+                char buf[32];
+                for (size_t i = 0; i < s->acc.size(); i++){
+                    snprintf(buf, sizeof(buf), ",%.2f", s->acc[i] / s->acc_ms);
+                    row += buf;
+                    s->acc[i] = 0;
+                }
+                s->acc_ms = 0;
+                ok = send_line(*s, row + "\n");
+            }
+        }
+        if (!ok){
+            close(s->fd);
+            s = subs.erase(s);
+        }else{
+            ++s;
+        }
+    }
+}
+
+// one poll of the listener and the subscribers: accepts, requests, hangups
+static bool serve(int timeout){
+    static vector<struct pollfd> fds;
+    fds.clear();
+    struct pollfd lp = { listen_fd, POLLIN, 0 };
+    fds.push_back(lp);
+    for (auto s = subs.cbegin(); s != subs.cend(); ++s){
+        struct pollfd p = { s->fd, (short)(s->eof ? 0 : POLLIN), 0 };
+        fds.push_back(p);
+    }
+    if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR){
+        perror("poll");
+        return false;
+    }
+    if (fds[0].revents & POLLIN){
+        int cfd;
+        while ((cfd = accept(listen_fd, NULL, NULL)) >= 0){
+            subscriber s;
+            s.fd = cfd;
+            s.eof = false;
+            s.subscribed = false;
+            s.interval_ms = 0;
+            s.acc_ms = 0;
+            subs.push_back(s);
+        }
+    }
+    // fds[i+1] matches subs[i] for the subscribers that existed before accept
+    vector<int> gone;
+    for (size_t i = 1; i < fds.size(); i++){
+        subscriber& s = subs[i-1];
+        if (s.eof ? (fds[i].revents & (POLLHUP | POLLERR)) != 0
+                  : (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !handle_input(s))
+            gone.push_back((int)i-1);
+    }
+    for (auto g = gone.rbegin(); g != gone.rend(); ++g){
+        close(subs[*g].fd);
+        subs.erase(subs.begin() + *g);
+    }
+    return true;
+}
+
+// -p: the event slices of pcie_collect() wait here, so LIST and SUBSCRIBE
+// are answered within a slice instead of a whole interval
+static void serve_for(double seconds){
+    typedef std::chrono::steady_clock clock;
+    const clock::time_point until = clock::now() + std::chrono::microseconds((long long)(seconds * 1000000));
+    for (clock::time_point now; (now = clock::now()) < until; ){
+        const auto left = std::chrono::duration_cast<std::chrono::microseconds>(until - now).count();
+        if (left >= 1000)
+            serve((int)(left / 1000));
+        else
+            usleep((useconds_t)left);       // the slice length is what the rates divide by
+    }
+}
+
+static uint64 base_interval(){
+    uint64 base = 0;
+    for (auto s = subs.cbegin(); s != subs.cend(); ++s)
+        if (s->subscribed && (base == 0 || s->interval_ms < base))
+            base = s->interval_ms;
+    return base;
+}
+
+static int listen_unix(const string& path, mode_t mode){
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0){
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)){
+        cerr << "socket path too long: " << path << endl;
+        close(fd);
+        return -1;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0){
+        perror(path.c_str());
+        close(fd);
+        return -1;
+    }
+    // the collector needs root for the PMU, readers don't
+    chmod(path.c_str(), mode);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int daemon_main(int argc, char** argv) {
+    cxxopts::Options options("daemon", "shared collector for many subscribers");
+    options.add_options()
+        ("g,debug",   "Enable debug info",    cxxopts::value<bool>()->default_value("false"))
+        ("u,socket",  "Unix socket path",     cxxopts::value<string>()->default_value("/run/pmt.sock"))
+        ("mode",      "Socket permissions",   cxxopts::value<string>()->default_value("0666"))
+        ("min",       "Finest interval, ms",  cxxopts::value<int>()->default_value("100"))
+        ("c,channels","Show memory channels", cxxopts::value<bool>()->default_value("false"))
+        ("p,pcie",    "Collect pcie bandwidth",cxxopts::value<bool>()->default_value("false"))
+        ("l,only",    "Show only pcie list",  cxxopts::value<string>()->default_value(""))
+        ("h,help",    "Print usage")
+    ;
+    add_alert_options(options);
+    add_detect_options(options);
+    add_ecam_options(options);
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    DEBUG = result["debug"].as<bool>();
+    SHOW_CHANNELS=result["channels"].as<bool>();
+    SHOW_MEMORY=true;
+    min_interval_ms = (uint64)(std::max)(1, result["min"].as<int>());
+    const bool pcie = result["pcie"].as<bool>();
+    split_only(result["only"].as<string>());
+    const string path = result["socket"].as<string>();
+    const mode_t mode = (mode_t)strtol(result["mode"].as<string>().c_str(), NULL, 8);
+
+    PCM *m = PCM::getInstance();
+    PCM::ErrorCode returnResult = m->program();
+    if (returnResult != PCM::Success) {
+        std::cerr << "PCM couldn't start" << std::endl;
+        std::cerr << "Error code: " << returnResult << std::endl;
+        exit(1);
+    }
+    ecam_setup(result);
+    sampler_setup(m, pcie);
+    columns = sampler_columns();
+    alert_setup(result, columns);
+    detect_setup(result, columns);
+
+    listen_fd = listen_unix(path, mode);
+    if (listen_fd < 0)
+        exit(EXIT_FAILURE);
+    if (pcie)
+        pcie_wait_hook(serve_for);
+    if (DEBUG)
+        cout << "listening on " << path << ", " << columns.size() << " metrics" << endl;
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point deadline = clock::now();
+    uint64 base_ms = 0;
+    vector<double> values;
+    values.reserve(columns.size());
+    run_signals();
+    while (!STOP){
+        const uint64 want = base_interval();
+        if (want == 0){
+            base_ms = 0;                       // nobody listening, no PMU reads
+        }else if (base_ms == 0){
+            base_ms = want;
+            sampler_reset(m);
+            deadline = clock::now() + std::chrono::milliseconds(base_ms);
+        }else if (want != base_ms){
+            base_ms = want;
+        }
+        if (base_ms)
+            delay = base_ms / 1000.0f;         // timestamp resolution
+
+        int timeout = -1;
+        if (base_ms && !pcie){
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+            timeout = left > 0 ? (int)left : 0;
+        }else if (base_ms){
+            timeout = 0;                       // the iio pass below is the wait
+        }
+
+        if (!serve(timeout))
+            break;
+
+        if (base_ms == 0)
+            continue;
+        if (pcie){
+            sampler_wait(m, base_ms / 1000.0);
+        }else if (clock::now() < deadline){
+            continue;
+        }
+        const uint64 elapsed = sampler_read(m, values);
+        publish(values, elapsed, currentDateTime(), base_ms);
+        deadline += std::chrono::milliseconds(base_ms);
+        if (deadline < clock::now())
+            deadline = clock::now() + std::chrono::milliseconds(base_ms);
+    }
+
+    for (auto s = subs.cbegin(); s != subs.cend(); ++s)
+        close(s->fd);
+    close(listen_fd);
+    unlink(path.c_str());
+    sampler_cleanup();
+    m->cleanup();
+    exit(EXIT_SUCCESS);
+}
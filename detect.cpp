@@ -0,0 +1,209 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Change-point events on the bandwidth series, checked on every interval's
+// values like the alert rules. The series are each memory channel's read and
+// write MB/s, each channel's % of its socket's traffic and each pcie device
+// direction. A series is a few doubles updated once per interval, nothing is
+// kept per sample, so thousands of series at 100 ms cost microseconds:
+//   cusum  baseline is an EWMA of mean and variance (alpha=), the residual
+//          z in baseline sigmas feeds g+ = max(0, g+ + z - k) and its mirror
+//   ph     Page-Hinkley: baseline is the mean since the last change, the
+//          cumulative z - k against its running minimum, both directions
+// A residual counts at most 4 sigmas, so with h=5 one spike doesn't fire but
+// a level shift does within two intervals. After warmup= intervals of
+// baseline a statistic past h= emits an event line with the series, the
+// direction, the old baseline and the new level, and the series starts over
+// at the new level. Sigma is floored at rel= of the baseline and at min= in
+// the series' unit, so a flat series doesn't fire on counter jitter.
+//   --detect "cusum h=6 metric=S*_IBW log=/var/log/pmt-changes"
+enum { SERIES_RATE, SERIES_SHARE };
+
+struct detect_series{
+    string name;
+    int kind;
+    int idx[4];                 // rate: column; share: channel R, W, socket Read, Write
+    double mean, var;
+    double up, up_min, down, down_min;
+    uint64 n, since;
+};
+
+static vector<detect_series> series;
+static bool page_hinkley = false;
+static double k_slack = 0.5, h_limit = 5, alpha = 0.05, rel_floor = 0.05, min_floor = 1;
+static uint64 warmup = 10;
+static string log_file;
+static std::ofstream log_out;
+
+void add_detect_options(cxxopts::Options& options){
+    options.add_options("detect")
+        ("detect", "Change-point events on channel and device bandwidth: cusum|ph [k=0.5] [h=5] [alpha=0.05] [warmup=10] [rel=0.05] [min=1] [metric=glob] [log=file]", cxxopts::value<string>()->default_value(""))
+    ;
+}
+
+static void restart(detect_series& s){
+    s.mean = s.var = 0;
+    s.up = s.up_min = s.down = s.down_min = 0;
+    s.n = s.since = 0;
+}
+
+static void add_series(const string& name, int kind, int a, int b, int c, int d, const string& metric){
+    if (metric.size() && fnmatch(metric.c_str(), name.c_str(), 0) != 0) return;
+    detect_series s;
+    s.name = name;
+    s.kind = kind;
+    s.idx[0] = a;
+    s.idx[1] = b;
+    s.idx[2] = c;
+    s.idx[3] = d;
+    restart(s);
+    series.push_back(s);
+}
+
+static bool pcie_column(const string& c){
+    static const char* dirs[4] = {"_IBW", "_IBR", "_OBR", "_OBW"};
+    if (c.size() < 6 || c[0] != 'S') return false;
+    for (int d = 0; d < 4; d++)
+        if (c.compare(c.size() - 4, 4, dirs[d]) == 0) return true;
+    return false;
+}
+
+void detect_setup(const cxxopts::ParseResult& result, const vector<string>& columns){
+    series.clear();
+    const string spec = result["detect"].as<string>();
+    if (spec.find_first_not_of(" \t") == string::npos) return;
+    stringstream ss(spec);
+    string tok, metric;
+    while (ss >> tok){
+        const size_t eq = tok.find('=');
+        const string key = tok.substr(0, eq), val = eq == string::npos ? "" : tok.substr(eq + 1);
+        if (tok == "cusum") page_hinkley = false;
+        else if (tok == "ph") page_hinkley = true;
+        else if (key == "k" && eq != string::npos) k_slack = atof(val.c_str());
+        else if (key == "h" && eq != string::npos) h_limit = atof(val.c_str());
+        else if (key == "alpha" && eq != string::npos) alpha = atof(val.c_str());
+        else if (key == "warmup" && eq != string::npos) warmup = (uint64)(std::max)(1, atoi(val.c_str()));
+        else if (key == "rel" && eq != string::npos) rel_floor = atof(val.c_str());
+        else if (key == "min" && eq != string::npos) min_floor = atof(val.c_str());
+        else if (key == "metric" && eq != string::npos) metric = val;
+        else if (key == "log" && eq != string::npos) log_file = val;
+        else{
+            cerr << "detect: unknown key " << tok << " in " << spec << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (alpha <= 0 || alpha > 1 || h_limit <= 0){
+        cerr << "detect: need 0 < alpha <= 1 and h > 0 in " << spec << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // S<s>C<c>R / S<s>C<c>W, each channel's share needs its socket's totals too
+    for (size_t i = 0; i < columns.size(); i++){
+        const string& c = columns[i];
+        unsigned s, ch;
+        char d;
+        int end = 0;
+        if (sscanf(c.c_str(), "S%uC%u%c%n", &s, &ch, &d, &end) == 3 && c[end] == 0 && (d == 'R' || d == 'W')){
+            add_series(c, SERIES_RATE, (int)i, -1, -1, -1, metric);
+            if (d != 'W' || i == 0 || columns[i - 1] != c.substr(0, c.size() - 1) + "R") continue;
+            const string skt = "S" + std::to_string(s);
+            const auto rd = std::find(columns.begin(), columns.end(), skt + "Read");
+            const auto wr = std::find(columns.begin(), columns.end(), skt + "Write");
+            if (rd != columns.end() && wr != columns.end())
+                add_series(c.substr(0, c.size() - 1) + "Share", SERIES_SHARE, (int)i - 1, (int)i,
+                           (int)(rd - columns.begin()), (int)(wr - columns.begin()), metric);
+        }else if (pcie_column(c)){
+            add_series(c, SERIES_RATE, (int)i, -1, -1, -1, metric);
+        }
+    }
+    if (series.empty()){
+        cerr << "detect: no channel or device columns" << (metric.size() ? " match " + metric : string()) << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (log_file.size()){
+        log_out.open(log_file.c_str(), std::ios_base::app);
+        if (!log_out.is_open()){
+            cerr << "detect: can't open " << log_file << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (DEBUG)
+        cerr << "detect: " << series.size() << " series, " << (page_hinkley ? "page-hinkley" : "cusum")
+             << " k=" << k_slack << " h=" << h_limit << endl;
+}
+
+static void emit(const detect_series& s, bool up, double before, double now, double stat){
+    const bool share = s.kind == SERIES_SHARE;
+    char buf[256];
+    snprintf(buf, sizeof(buf), " CHANGE %s %s %.2f -> %.2f%s (x%.2f) %s=%.2f after %llu intervals\n",
+             s.name.c_str(), up ? "up" : "down", before, now, share ? "%" : " MB/s",
+             before > 0 ? now / before : 0.0, page_hinkley ? "ph" : "cusum", stat, (unsigned long long)s.since);
+    const string line = currentDateTime() + buf;
+    if (log_out.is_open())
+        log_out << line << flush;
+    else
+        cerr << line << flush;
+}
+
+// one interval's values, in the columns given to detect_setup()
+void detect_check(const vector<double>& values){
+    for (auto s = series.begin(); s != series.end(); ++s){
+        double x;
+        if (s->kind == SERIES_RATE){
+            if (s->idx[0] >= (int)values.size()) continue;
+            x = values[s->idx[0]];
+        }else{
+            if (*std::max_element(s->idx, s->idx + 4) >= (int)values.size()) continue;
+            const double total = values[s->idx[2]] + values[s->idx[3]];
+            if (total <= 0) continue;              // idle socket: no share to speak of
+            x = (values[s->idx[0]] + values[s->idx[1]]) / total * 100;
+        }
+        s->since++;
+        const double sigma = (std::max)((std::max)(sqrt(s->var), rel_floor * fabs(s->mean)), min_floor);
+        const double z = (std::max)(-4.0, (std::min)(4.0, (x - s->mean) / sigma));
+        if (s->n >= warmup){
+            if (page_hinkley){
+                s->up += z - k_slack;
+                s->down += -z - k_slack;
+                s->up_min = (std::min)(s->up_min, s->up);
+                s->down_min = (std::min)(s->down_min, s->down);
+            }else{
+                s->up = (std::max)(0.0, s->up + z - k_slack);
+                s->down = (std::max)(0.0, s->down - z - k_slack);
+            }
+            const double up = s->up - s->up_min, down = s->down - s->down_min;
+            if (up > h_limit || down > h_limit){
+                emit(*s, up > h_limit, s->mean, x, (std::max)(up, down));
+                const double var = s->var;
+                restart(*s);
+                s->var = var;
+                s->mean = x;
+                s->n = 1;
+                continue;
+            }
+        }
+        // running mean while warming up (and always for ph), EWMA after;
+        // past warmup the baseline takes the clipped residual so one spike
+        // can't drag it off the level
+        s->n++;
+        const double a = (page_hinkley || s->n <= warmup) ? 1.0 / s->n : alpha;
+        const double d = s->n <= warmup ? x - s->mean : z * sigma;
+        s->mean += a * d;
+        s->var = s->n == 1 ? 0 : (1 - a) * (s->var + a * d * d);
+    }
+}
@@ -0,0 +1,109 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// PCI config space of segment 0 through the MMCONFIG (ECAM) window, mapped
+// once: every config dword of discovery is then a load from the mapping
+// instead of an open/pread per function. --ecam auto takes the window from
+// the ACPI MCFG table and maps it from /dev/mem (root, as pcm's own
+// PCM_USE_PCI_MM_LINUX build does). --ecam file[:offset[:first_bus[:last_bus]]]
+// maps any file at that offset instead, e.g. a fake region built for a test:
+// bus b, dev d, fn f, register r lives at offset + ((b - first_bus) << 20 |
+// d << 15 | f << 12 | r). The IMC counters on ICX/SPR are MMIO already and
+// pcm reads them through its own mapping, so this covers our own config
+// reads: probe_pci() and the SAD_CONTROL_CFG read of getSadIdRootBusMap().
+static const volatile uint8_t* window = NULL;
+static size_t window_len = 0;
+static uint32 first_bus = 0, last_bus = 255;
+
+void add_ecam_options(cxxopts::Options& options){
+    options.add_options("ecam")
+        ("ecam", "PCI config space through the ECAM window: auto (ACPI MCFG, /dev/mem) or file[:offset[:first_bus[:last_bus]]]", cxxopts::value<string>()->default_value(""))
+    ;
+}
+
+// segment 0 of /sys/firmware/acpi/tables/MCFG: 36 byte header, 8 reserved,
+// then 16 byte entries {u64 base, u16 segment, u8 start bus, u8 end bus, u32}
+static bool mcfg_segment0(uint64& base, uint32& first, uint32& last){
+    std::ifstream in("/sys/firmware/acpi/tables/MCFG", std::ios_base::binary);
+    const string t((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    for (size_t e = 44; e + 16 <= t.size(); e += 16){
+        uint16_t segment;
+        memcpy(&base, t.data() + e, 8);
+        memcpy(&segment, t.data() + e + 8, 2);
+        if (segment != 0) continue;
+        first = (uint8_t)t[e + 10];
+        last = (uint8_t)t[e + 11];
+        return true;
+    }
+    return false;
+}
+
+static bool map_window(const string& path, uint64 offset){
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        cerr << "ecam: can't open " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    window_len = (size_t)(last_bus - first_bus + 1) << 20;
+    void* p = mmap(NULL, window_len, PROT_READ, MAP_SHARED, fd, (off_t)offset);
+    close(fd);
+    if (p == MAP_FAILED){
+        cerr << "ecam: can't map " << window_len << " bytes of " << path << " at 0x" << std::hex << offset << std::dec << ": " << strerror(errno) << endl;
+        return false;
+    }
+    window = (const volatile uint8_t*)p;
+    return true;
+}
+
+// with "auto" a missing MCFG or /dev/mem leaves discovery on probe_pci()
+void ecam_setup(const cxxopts::ParseResult& result){
+    const string spec = result["ecam"].as<string>();
+    if (spec.empty()) return;
+    if (spec == "auto"){
+        uint64 base = 0;
+        if (!mcfg_segment0(base, first_bus, last_bus)){
+            cerr << "ecam: no segment 0 in the ACPI MCFG table, using pci config files" << endl;
+            return;
+        }
+        if (!map_window("/dev/mem", base))
+            cerr << "ecam: using pci config files" << endl;
+        return;
+    }
+    vector<string> f;
+    stringstream ss(spec);
+    string item;
+    while (getline(ss, item, ':'))
+        f.push_back(item);
+    const uint64 offset = f.size() > 1 ? strtoull(f[1].c_str(), NULL, 0) : 0;
+    first_bus = f.size() > 2 ? (uint32)strtoul(f[2].c_str(), NULL, 0) & 0xff : 0;
+    last_bus = f.size() > 3 ? (uint32)strtoul(f[3].c_str(), NULL, 0) & 0xff : 255;
+    if (last_bus < first_bus || !map_window(f[0], offset))
+        exit(EXIT_FAILURE);
+}
+
+bool ecam_active(){
+    return window != NULL;
+}
+
+// all ones outside the window, like a config read of an absent function
+uint32 ecam_read32(uint32 bus, uint32 dev, uint32 fn, uint32 reg){
+    if (!window || bus < first_bus || bus > last_bus) return 0xffffffff;
+    const size_t off = (size_t)(bus - first_bus) << 20 | (dev & 0x1f) << 15 | (fn & 7) << 12 | (reg & 0xffc);
+    return *(const volatile uint32_t*)(window + off);
+}
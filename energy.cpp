@@ -0,0 +1,62 @@
+#include "cpucounters.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// RAPL package and DRAM energy per socket, read at the same points as the
+// bandwidth counters so watts and GB/s cover one window. The energy status
+// only comes with the full uncore state, so this read is paid for only with -e.
+static bool pkg_available = false, dram_available = false;
+
+bool energy_setup(PCM *m){
+    pkg_available = m->packageEnergyMetricsAvailable();
+    dram_available = m->dramEnergyMetricsAvailable();
+    if (!pkg_available && !dram_available){
+        cerr << "energy: no RAPL package or DRAM energy counters on this cpu" << endl;
+        return false;
+    }
+    if (!dram_available)
+        cerr << "energy: no RAPL DRAM energy counter, DramW stays 0" << endl;
+    return true;
+}
+
+void energy_read(PCM *m, vector<ServerUncoreCounterState>& states){
+    states.resize(m->getNumSockets());
+    for (uint32 i=0; i<states.size(); ++i)
+        states[i] = m->getServerUncoreCounterState(i);
+}
+
+vector<string> energy_columns(uint32 numSockets){
+    static const char* names[4] = {"PkgW", "DramW", "GBpsPerPkgW", "GBpsPerDramW"};
+    vector<string> columns;
+    for (uint32 i=0; i<numSockets; ++i)
+        for (int n=0; n<4; n++)
+            columns.push_back("S" + std::to_string(i) + names[n]);
+    return columns;
+}
+
+// watts and GB/s per watt in energy_columns() order, socket_mbps is the
+// bandwidth each socket moved in the same window
+void energy_values(uint32 numSockets, const vector<ServerUncoreCounterState>& before, const vector<ServerUncoreCounterState>& after,
+                   const uint64 elapsedTime, const vector<double>& socket_mbps, vector<double>& values){
+    auto round2 = [](double v){ return roundf(v * 100) / 100; };
+    const double seconds = elapsedTime / 1000.0;
+    for (uint32 i=0; i<numSockets; ++i){
+        if (i >= before.size() || i >= after.size() || seconds <= 0){
+            values.insert(values.end(), 4, 0.0);
+            continue;
+        }
+        const double pkgW  = pkg_available  ? getConsumedJoules(before[i], after[i]) / seconds : 0;
+        const double dramW = dram_available ? getDRAMConsumedJoules(before[i], after[i]) / seconds : 0;
+        const double gbps = i < socket_mbps.size() ? socket_mbps[i] / 1000 : 0;
+        values.push_back(round2(pkgW));
+        values.push_back(round2(dramW));
+        values.push_back(pkgW > 0 ? round2(gbps / pkgW) : 0);
+        values.push_back(dramW > 0 ? round2(gbps / dramW) : 0);
+    }
+}
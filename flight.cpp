@@ -0,0 +1,266 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <future>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Flight recorder: the last N minutes of samples stay in a ring allocated up
+// front, nothing touches the disk until SIGUSR1 or "dump" on the control fifo.
+//
+// binary dump layout (little endian):
+//   char[8] "PMTFR1\0\0", uint32 ncols, uint32 nrows,
+//   ncols x (uint32 len, char name[len]),
+//   nrows x (uint64 epoch_ms, uint64 elapsed_ms, double value[ncols])
+static volatile sig_atomic_t dump_requested = 0;
+
+static void on_sigusr1(int){
+    dump_requested = 1;
+}
+
+struct flight_ring{
+    vector<string> columns;
+    vector<uint64> epoch_ms;
+    vector<uint64> elapsed_ms;
+    vector<double> values;      // rows x columns
+    size_t capacity;
+    size_t head;                // next row to write
+    size_t count;
+};
+
+// oldest first copy, so the sampler can go on while the copy is written
+static flight_ring snapshot(const flight_ring& r){
+    flight_ring s;
+    s.columns = r.columns;
+    s.capacity = s.count = r.count;
+    s.head = 0;
+    const size_t ncols = r.columns.size();
+    s.epoch_ms.reserve(r.count);
+    s.elapsed_ms.reserve(r.count);
+    s.values.reserve(r.count * ncols);
+    size_t first = (r.head + r.capacity - r.count) % r.capacity;
+    for (size_t i = 0; i < r.count; i++){
+        size_t row = (first + i) % r.capacity;
+        s.epoch_ms.push_back(r.epoch_ms[row]);
+        s.elapsed_ms.push_back(r.elapsed_ms[row]);
+        s.values.insert(s.values.end(), r.values.begin() + row * ncols, r.values.begin() + (row + 1) * ncols);
+    }
+    return s;
+}
+
+static bool write_dump(const flight_ring& s, const string& path, bool binary, uint64 seq){
+    // written beside the target and renamed, readers never see a partial dump;
+    // the tmp name is the writer's own, so two dumps to one path can't interleave
+    const string tmp = path + ".tmp." + std::to_string(seq);
+    std::ofstream out(tmp.c_str(), std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+    if (!out.is_open()){
+        cerr << "flight: can't open " << tmp << endl;
+        return false;
+    }
+    const size_t ncols = s.columns.size();
+    if (binary){
+        const char magic[8] = {'P','M','T','F','R','1',0,0};
+        uint32 n = (uint32)ncols, rows = (uint32)s.count;
+        out.write(magic, sizeof(magic));
+        out.write((const char*)&n, sizeof(n));
+        out.write((const char*)&rows, sizeof(rows));
+        for (auto c = s.columns.cbegin(); c != s.columns.cend(); ++c){
+            uint32 len = (uint32)c->size();
+            out.write((const char*)&len, sizeof(len));
+            out.write(c->data(), len);
+        }
+        for (size_t i = 0; i < s.count; i++){
+            out.write((const char*)&s.epoch_ms[i], sizeof(uint64));
+            out.write((const char*)&s.elapsed_ms[i], sizeof(uint64));
+            out.write((const char*)&s.values[i * ncols], ncols * sizeof(double));
+        }
+    }else{
+        out << "Time,Elapsed";
+        for (auto c = s.columns.cbegin(); c != s.columns.cend(); ++c)
+            out << "," << *c;
+        out << "\n";
+        char buf[32];
+        for (size_t i = 0; i < s.count; i++){
+            out << formatDateTime(s.epoch_ms[i]) << "," << s.elapsed_ms[i];
+            for (size_t c = 0; c < ncols; c++){
+                snprintf(buf, sizeof(buf), ",%.2f", s.values[i * ncols + c]);
+                out << buf;
+            }
+            out << "\n";
+        }
+    }
+    out.close();
+    if (!out || rename(tmp.c_str(), path.c_str()) != 0){
+        cerr << "flight: failed to write " << path << endl;
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// writers still running are waited for before exit, so a dump asked for
+// just before SIGINT/SIGTERM is finished and renamed instead of left as .tmp
+static vector<std::future<void>> writers;
+static uint64 dump_seq = 0;
+
+static void dump(const flight_ring& r, string path, const string& prefix, bool binary){
+    if (r.count == 0) return;
+    const uint64 seq = ++dump_seq;
+    if (path.empty()){
+        // milliseconds and the dump number: two dumps in one second get two files
+        const uint64 now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        const time_t now = (time_t)(now_ms / 1000);
+        tm localTime;
+        localtime_r(&now, &localTime);
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", &localTime);
+        char ms[32];
+        snprintf(ms, sizeof(ms), ".%03u-%llu", (unsigned)(now_ms % 1000), (unsigned long long)seq);
+        path = prefix + "-" + buf + ms + (binary ? ".bin" : ".csv");
+    }
+    // finished writers are dropped here, the list only holds running ones
+    writers.erase(std::remove_if(writers.begin(), writers.end(), [](const std::future<void>& w){
+        return w.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), writers.end());
+    writers.push_back(std::async(std::launch::async, [](flight_ring s, string p, bool b, uint64 n){
+        if (write_dump(s, p, b, n))
+            cerr << "flight: dumped " << s.count << " samples to " << p << endl;
+    }, snapshot(r), path, binary, seq));
+}
+
+static void join_writers(){
+    for (auto w = writers.begin(); w != writers.end(); ++w)
+        w->wait();
+    writers.clear();
+}
+
+// "dump [path]" lines from the control fifo, non blocking
+static void poll_control(int fd, string& pending, vector<string>& requests){
+    if (fd < 0) return;
+    char buf[256];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        pending.append(buf, n);
+    size_t pos;
+    while ((pos = pending.find('\n')) != string::npos){
+        string line = pending.substr(0, pos);
+        pending.erase(0, pos + 1);
+        if (line.compare(0, 4, "dump") != 0) continue;
+        string path = line.size() > 5 ? line.substr(5) : "";
+        requests.push_back(path);
+    }
+}
+
+int flight_main(int argc, char** argv) {
+    cxxopts::Options options("flight", "in-memory flight recorder, dump on SIGUSR1");
+    options.add_options()
+        ("g,debug",   "Enable debug info",    cxxopts::value<bool>()->default_value("false"))
+        ("s,delay",   "Seconds/update",       cxxopts::value<float>()->default_value("0.1"))
+        ("m,minutes", "Minutes kept in ring", cxxopts::value<float>()->default_value("10"))
+        ("o,output",  "Dump file prefix",     cxxopts::value<string>()->default_value("/var/tmp/pmt-flight"))
+        ("b,binary",  "Binary dumps",         cxxopts::value<bool>()->default_value("false"))
+        ("control",   "Control fifo path",    cxxopts::value<string>()->default_value(""))
+        ("c,channels","Show memory channels", cxxopts::value<bool>()->default_value("false"))
+        ("p,pcie",    "Record pcie bandwidth",cxxopts::value<bool>()->default_value("false"))
+        ("l,only",    "Show only pcie list",  cxxopts::value<string>()->default_value(""))
+        ("h,help",    "Print usage")
+    ;
+    add_run_options(options);
+    add_alert_options(options);
+    add_detect_options(options);
+    add_ecam_options(options);
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    DEBUG = result["debug"].as<bool>();
+    delay = result["delay"].as<float>();
+    SHOW_CHANNELS = result["channels"].as<bool>();
+    SHOW_MEMORY = true;
+    split_only(result["only"].as<string>());
+    const string prefix = result["output"].as<string>();
+    const bool binary = result["binary"].as<bool>();
+    const string control = result["control"].as<string>();
+
+    PCM *m = PCM::getInstance();
+    PCM::ErrorCode returnResult = m->program();
+    if (returnResult != PCM::Success) {
+        std::cerr << "PCM couldn't start" << std::endl;
+        std::cerr << "Error code: " << returnResult << std::endl;
+        exit(1);
+    }
+    ecam_setup(result);
+    sampler_setup(m, result["pcie"].as<bool>());
+
+    flight_ring ring;
+    ring.columns = sampler_columns();
+    alert_setup(result, ring.columns);
+    detect_setup(result, ring.columns);
+    ring.capacity = (std::max)((size_t)1, (size_t)(result["minutes"].as<float>() * 60 / delay));
+    ring.head = ring.count = 0;
+    ring.epoch_ms.assign(ring.capacity, 0);
+    ring.elapsed_ms.assign(ring.capacity, 0);
+    ring.values.assign(ring.capacity * ring.columns.size(), 0.0);
+    if (DEBUG)
+        cout << "flight: " << ring.capacity << " x " << ring.columns.size() << " samples, "
+             << (ring.values.size() * sizeof(double) >> 20) << " MB" << endl;
+
+    int cfd = -1;
+    if (control.size()){
+        if (mkfifo(control.c_str(), 0600) < 0 && errno != EEXIST){
+            perror(control.c_str());
+            exit(EXIT_FAILURE);
+        }
+        // O_RDWR keeps the fifo open across writers coming and going
+        cfd = open(control.c_str(), O_RDWR | O_NONBLOCK);
+    }
+    signal(SIGUSR1, on_sigusr1);
+    run_setup(result);
+
+    vector<double> values;
+    values.reserve(ring.columns.size());
+    string pending;
+    vector<string> requests;
+    while (!STOP){
+        sampler_wait(m, delay);
+        const uint64 elapsed = sampler_read(m, values);
+        ring.epoch_ms[ring.head] = epochMs();
+        ring.elapsed_ms[ring.head] = elapsed;
+        std::copy(values.begin(), values.end(), ring.values.begin() + ring.head * ring.columns.size());
+        ring.head = (ring.head + 1) % ring.capacity;
+        if (ring.count < ring.capacity) ring.count++;
+
+        poll_control(cfd, pending, requests);
+        if (dump_requested){
+            dump_requested = 0;
+            requests.push_back("");
+        }
+        for (auto r = requests.cbegin(); r != requests.cend(); ++r)
+            dump(ring, *r, prefix, binary);
+        requests.clear();
+        if (!run_continue(values)) break;
+    }
+
+    if (cfd >= 0) close(cfd);
+    join_writers();
+    sampler_cleanup();
+    m->cleanup();
+    exit(EXIT_SUCCESS);
+}
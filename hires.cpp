@@ -0,0 +1,172 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// High rate IMC sampling, down to ~100us. Nothing in the loop allocates,
+// formats or calls localtime: each tick reads the IMC state, stores the
+// per-channel deltas into a preallocated column batch and only full batches
+// hit the disk.
+//
+// file layout (little endian):
+//   char[8] "PMTHR1\0\0", uint32 ncols, uint32 interval_us,
+//   ncols x (uint32 len, char name[len]),
+//   batches of: uint32 nrows, then ncols x (nrows x uint64)
+// column 0 is CLOCK_MONOTONIC ns at the read, the rest are 64B line counts.
+static inline uint64 monotonic_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool write_batch(FILE* f, const vector<uint64>& batch, uint32 ncols, uint32 rows, uint32 capacity){
+    if (rows == 0) return true;
+    if (fwrite(&rows, sizeof(rows), 1, f) != 1) return false;
+    for (uint32 c = 0; c < ncols; c++)
+        if (fwrite(&batch[(size_t)c * capacity], sizeof(uint64), rows, f) != rows) return false;
+    return true;
+}
+
+int hires_main(int argc, char** argv) {
+    cxxopts::Options options("hires", "high rate memory bandwidth sampling to a binary file");
+    options.add_options()
+        ("g,debug",   "Enable debug info",    cxxopts::value<bool>()->default_value("false"))
+        ("o,output",  "Binary output file",   cxxopts::value<string>()->default_value("pmt-hires.bin"))
+        ("u,us",      "Microseconds/update",  cxxopts::value<int>()->default_value("1000"))
+        ("b,batch",   "Samples per write",    cxxopts::value<int>()->default_value("65536"))
+        ("busy",      "Busy poll instead of timerfd", cxxopts::value<bool>()->default_value("false"))
+        ("h,help",    "Print usage")
+    ;
+    add_run_options(options);
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    DEBUG = result["debug"].as<bool>();
+    OUT_FILE = result["output"].as<string>();
+    const int interval_us = (std::max)(100, result["us"].as<int>());
+    delay = interval_us / 1000000.0f;     // run_continue() ends -n runs on it
+    const uint32 capacity = (uint32)(std::max)(1, result["batch"].as<int>());
+    const bool busy = result["busy"].as<bool>();
+
+    PCM *m = PCM::getInstance();
+    PCM::ErrorCode returnResult = m->program();
+    if (returnResult != PCM::Success) {
+        std::cerr << "PCM couldn't start" << std::endl;
+        std::cerr << "Error code: " << returnResult << std::endl;
+        exit(1);
+    }
+    const uint32 numSockets = m->getNumSockets();
+    const uint32 channels = (uint32)m->getMCChannelsPerSocket();
+
+    vector<string> columns;
+    columns.push_back("ns");
+    char buf[64];
+    for (uint32 i=0; i<numSockets; ++i) {
+        for (uint32 c=0; c<channels; ++c){
+            snprintf(buf, sizeof(buf), "S%dC%dR", i, c);
+            columns.push_back(buf);
+            snprintf(buf, sizeof(buf), "S%dC%dW", i, c);
+            columns.push_back(buf);
+        }
+    }
+    const uint32 ncols = (uint32)columns.size();
+
+    FILE* f = fopen(OUT_FILE.c_str(), "wb");
+    if (!f){
+        perror(OUT_FILE.c_str());
+        exit(EXIT_FAILURE);
+    }
+    const char magic[8] = {'P','M','T','H','R','1',0,0};
+    const uint32 us = (uint32)interval_us;
+    fwrite(magic, sizeof(magic), 1, f);
+    fwrite(&ncols, sizeof(ncols), 1, f);
+    fwrite(&us, sizeof(us), 1, f);
+    for (auto c = columns.cbegin(); c != columns.cend(); ++c){
+        uint32 len = (uint32)c->size();
+        fwrite(&len, sizeof(len), 1, f);
+        fwrite(c->data(), 1, len, f);
+    }
+
+    vector<uint64> batch((size_t)ncols * capacity, 0);
+    imc_setup(m);
+    imc_state before, after;
+    vector<uint64> reads, writes;       // 48-bit wrap handled by imc_deltas()
+    imc_read(before);
+
+    int tfd = -1;
+    if (!busy){
+        tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+        struct itimerspec its;
+        its.it_interval.tv_sec = interval_us / 1000000;
+        its.it_interval.tv_nsec = (interval_us % 1000000) * 1000L;
+        its.it_value = its.it_interval;
+        if (tfd < 0 || timerfd_settime(tfd, 0, &its, NULL) < 0){
+            perror("timerfd");
+            exit(EXIT_FAILURE);
+        }
+    }
+    run_setup(result);
+    const vector<double> no_values;
+
+    uint64 missed = 0, written = 0;
+    uint32 rows = 0;
+    uint64 next = monotonic_ns() + (uint64)interval_us * 1000;
+    bool ok = true;
+    while (ok){
+        if (busy){
+            uint64 now;
+            while ((now = monotonic_ns()) < next) {}
+            if (now - next > (uint64)interval_us * 1000)
+                missed += (now - next) / ((uint64)interval_us * 1000);
+            next += (uint64)interval_us * 1000;
+        }else{
+            uint64 expirations = 0;
+            if (read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations)){
+                if (errno == EINTR){
+                    if (STOP) break;
+                    continue;
+                }
+                perror("timerfd read");
+                break;
+            }
+            missed += expirations - 1;
+        }
+        imc_read(after);
+        batch[rows] = monotonic_ns();
+        imc_deltas(before, after, reads, writes);
+        uint32 col = 1;
+        for (uint32 i=0; i<numSockets * channels; ++i) {
+            batch[(size_t)col++ * capacity + rows] = reads[i];
+            batch[(size_t)col++ * capacity + rows] = writes[i];
+        }
+        swap(before, after);
+        if (++rows == capacity){
+            ok = write_batch(f, batch, ncols, rows, capacity);
+            written += rows;
+            rows = 0;
+        }
+        if (!run_continue(no_values)) break;
+    }
+    ok = ok && write_batch(f, batch, ncols, rows, capacity);
+    written += rows;
+    if (tfd >= 0) close(tfd);
+    if (fclose(f) != 0 || !ok)
+        cerr << "hires: write to " << OUT_FILE << " failed" << endl;
+    cerr << "hires: " << written << " samples every " << interval_us << "us, " << missed << " ticks missed" << endl;
+    m->cleanup();
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -3,45 +3,27 @@
 #include <iostream>
 #include <string>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <chrono>
-#include <map>
-#include <math.h>
+#include <algorithm>
 #include <fstream>
-#include "pcm-pcie.h"
-//pcm-raw -e imc/config=0x09,name=ECC_CORRECTABLE_ERRORS/
-//https://github.com/Chester-Gillon/pcm
+#include <signal.h>
+#include "pmt.h"
 
 using namespace std;
 using namespace pcm;
 
-ofstream OUT;
 string OUT_FILE="";
 float delay=1.0;
 bool DEBUG=false;
-bool SHOW_CHANNELS=false;
-bool SHOW_MEMORY=false;
-bool SHOW_PCIE=false;
-string SEP="    ";
-constexpr uint32 max_sockets = 256;
-uint32 max_imc_channels = ServerUncoreCounterState::maxChannels;
-const uint32 max_edc_channels = ServerUncoreCounterState::maxChannels;
-const uint32 max_imc_controllers = ServerUncoreCounterState::maxControllers;
-
-void empty_output(){
-    std::ofstream out(OUT_FILE);
-    out << "";
-    out.close();
-}
-void append_file(string data){
-    //OUT.open(OUT_FILE, ios_base::app);
-    //if (OUT.is_open()){
-        //cout<<"data("<<data.size() <<")="<<data<<endl;
-        //OUT.write(data.data(), data.size());
-        OUT << data;
-        OUT.flush();
-    //}
-}
+volatile sig_atomic_t STOP=0;
+
+static std::chrono::steady_clock::time_point run_start;
+static float run_duration=0;
+static uint64 run_count=0;
+static uint64 run_intervals=0;
+static vector<double> run_sum, run_max;
 
 string currentDateTime() {
     tm localTime;
@@ -59,109 +41,119 @@ string currentDateTime() {
     return buf;
 }
 
-IPlatform *IPlatform::getPlatform(PCM *m, bool csv, bool bw, bool verbose, uint32 delay){
-    switch (m->getCPUModel()) {
-	case PCM::SPR:
-            return new EagleStreamPlatform(m, csv, bw, verbose, delay);
-        case PCM::ICX:
-        case PCM::SNOWRIDGE:
-            return new WhitleyPlatform(m, csv, bw, verbose, delay);
-        case PCM::SKX:
-            //return new PurleyPlatform(m, csv, bw, verbose, delay);
-        case PCM::BDX_DE:
-        case PCM::BDX:
-        case PCM::KNL:
-        case PCM::HASWELLX:
-            //return new GrantleyPlatform(m, csv, bw, verbose, delay);
-        case PCM::IVYTOWN:
-        case PCM::JAKETOWN:
-            //return new BromolowPlatform(m, csv, bw, verbose, delay);
-        default:
-          return NULL;
+static void on_stop(int){
+    STOP = 1;
+}
+
+uint64 epochMs(){
+    return (uint64)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+string formatDateTime(uint64 epoch_ms){
+    tm localTime;
+    time_t sec = (time_t)(epoch_ms / 1000);
+    localtime_r(&sec, &localTime);
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%03d", localTime.tm_year + 1900, localTime.tm_mon + 1,
+             localTime.tm_mday, localTime.tm_hour, localTime.tm_min, localTime.tm_sec, (int)(epoch_ms % 1000));
+    return buf;
+}
+
+// one row of the all/replay writer: csv for files, aligned for the terminal
+void write_values(std::ostream& out, const string& time, const vector<double>& row, bool csv){
+    char buf[32];
+    out << time;
+    for (auto v = row.cbegin(); v != row.cend(); ++v){
+        snprintf(buf, sizeof(buf), csv ? ",%.2f" : "    %6.2f", *v);
+        out << buf;
     }
+    out << "\n";
 }
 
-void printMemBW(uint32 numSockets, const ServerUncoreCounterState uncState1[], const ServerUncoreCounterState uncState2[], const uint64 elapsedTime){
-    auto toBW = [&elapsedTime](const uint64 nEvents){
-        float val=(nEvents * 64 / 1000000.0 / (elapsedTime / 1000.0));
-        return roundf(val * 100) / 100;
-    };
-    uint64 reads=0, writes=0;
-    int READ=0;
-    int WRITE=1;
-    for (uint32 i=0; i<numSockets; ++i) {
-        uint64 sktReads=0, sktWrites=0;
-        for (uint32 channel=0; channel<max_imc_channels; ++channel){
-            reads  = getMCCounter(channel, READ,  uncState1[i], uncState2[i]);
-            writes = getMCCounter(channel, WRITE, uncState1[i], uncState2[i]);
-            sktReads+=reads;
-            sktWrites+=writes;
-            if (SHOW_CHANNELS){
-                if (OUT_FILE.size()<1){
-	                cout << SEP << setw(6) << toBW(reads) << SEP << setw(6) << toBW(writes);
-                }else{
-                    char buf[256];
-                    snprintf(buf, sizeof(buf), ",%.2f,%.2f", toBW(reads),toBW(writes));
-                    append_file(buf);
-                }
-            }
-        }
-		if (SHOW_MEMORY){
-            if (OUT_FILE.size()<1){
-                cout << SEP << setw(6) << toBW(sktReads) << SEP << setw(6) << toBW(sktWrites);
-            }else{
-                char buf[128];
-                snprintf(buf, 128, ",%.2f,%.2f",toBW(sktReads),toBW(sktWrites));
-                append_file(buf);
-            }
-	    }
+// SIGINT/SIGTERM only raise STOP: the interval in flight is finished,
+// written and the PMU cleaned up by the normal exit path.
+void run_signals(){
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    run_start = std::chrono::steady_clock::now();
+}
+
+void add_run_options(cxxopts::Options& options){
+    options.add_options("run")
+        ("n,duration","Seconds to run, 0 runs until SIGINT/SIGTERM",   cxxopts::value<float>()->default_value("0"))
+        ("count",     "Intervals to run, 0 runs until SIGINT/SIGTERM", cxxopts::value<int>()->default_value("0"))
+    ;
+}
+
+void run_setup(const cxxopts::ParseResult& result){
+    run_duration = result["duration"].as<float>();
+    run_count = (uint64)(std::max)(0, result["count"].as<int>());
+    run_signals();
+}
+
+// account the interval just written, false once the run is over
+bool run_continue(const vector<double>& values){
+    run_intervals++;
+    if (run_sum.size() < values.size()){
+        run_sum.resize(values.size(), 0.0);
+        run_max.resize(values.size(), 0.0);
     }
+    for (size_t i = 0; i < values.size(); i++){
+        run_sum[i] += values[i];
+        run_max[i] = (std::max)(run_max[i], values[i]);
+    }
+    if (STOP) return false;
+    if (run_count && run_intervals >= run_count) return false;
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+    if (run_duration > 0 && elapsed + delay / 2 >= run_duration) return false;
+    return true;
+}
 
-    if (OUT_FILE.size()<1){
-        cout << endl << flush;
-    }else{
-        append_file("\n");
+void run_summary(const vector<string>& columns){
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%llu intervals in %.1f s", (unsigned long long)run_intervals, elapsed);
+    cerr << buf << (STOP ? ", stopped by signal" : "") << endl;
+    for (size_t i = 0; i < columns.size() && i < run_sum.size() && run_intervals; i++){
+        snprintf(buf, sizeof(buf), "    %-24s mean %10.2f  max %10.2f", columns[i].c_str(), run_sum[i] / run_intervals, run_max[i]);
+        cerr << buf << endl;
     }
 }
 
-int main(int argc, char** argv) {
-    cxxopts::Options options("pmt", "cpu performance monitor tool");
+// IMC and IIO from one PCM instance: the memory window spans the whole pass,
+// the iio events are sliced inside it, and both land on one row with one timestamp.
+int all_main(int argc, char** argv) {
+    cxxopts::Options options("all", "memory and pcie bandwidth in one row");
     options.add_options()
         ("g,debug",   "Enable debug info",    cxxopts::value<bool>()->default_value("false"))
-        ("v,version", "Version output",       cxxopts::value<bool>()->default_value("false"))
         ("o,output",  "Write to csv file",    cxxopts::value<string>()->default_value(""))
         ("s,delay",   "Seconds/update",       cxxopts::value<float>()->default_value("1.0"))
-        ("m,memory",  "Show memory bandwidth",cxxopts::value<bool>()->default_value("true"))
         ("c,channels","Show memory channels", cxxopts::value<bool>()->default_value("false"))
-        ("p,pcie",    "Show pcie bandwidth",  cxxopts::value<bool>()->default_value("false"))
+        ("l,only",    "Show only pcie list",  cxxopts::value<string>()->default_value(""))
         ("h,help",    "Print usage")
-        //("n,duration","Duration",         cxxopts::value<int>()->default_value("60"))
     ;
+    add_trigger_options(options);
+    add_run_options(options);
+    add_stats_options(options);
+    add_alert_options(options);
+    add_detect_options(options);
+    add_ecam_options(options);
     auto result = options.parse(argc, argv);
     if (result.count("help")){
       std::cout << options.help() << std::endl;
       exit(0);
     }
-    if (result.count("version")){
-      std::cout << "cpu performance monitor tool\n" << "version: 0.0.1" << std::endl;
-      exit(0);
-    }
-
     DEBUG = result["debug"].as<bool>();
-    //if (DEBUG) spdlog::set_level(spdlog::level::debug);
-    //else spdlog::set_level(spdlog::level::warn);
     OUT_FILE=result["output"].as<string>();
-    if (OUT_FILE.size()>0){
-        SEP=",";
-        empty_output();
-        OUT.open(OUT_FILE, ios_base::app);
-    }
-    //cout<<"OUT_FILE.size()="<<OUT_FILE.size()<<endl;
     SHOW_CHANNELS=result["channels"].as<bool>();
-    SHOW_MEMORY=result["memory"].as<bool>();
-    SHOW_PCIE=result["pcie"].as<bool>();
-    delay=result["delay"].as<float>(); //PCM_DELAY_DEFAULT
-    /////////////////////////////////////////////
+    SHOW_MEMORY=true;
+    delay=result["delay"].as<float>();
+    split_only(result["only"].as<string>());
+
     PCM *m = PCM::getInstance();
     PCM::ErrorCode returnResult = m->program();
     if (returnResult != PCM::Success) {
@@ -169,85 +161,106 @@ int main(int argc, char** argv) {
         std::cerr << "Error code: " << returnResult << std::endl;
         exit(1);
     }
-    unique_ptr<IPlatform> platform(IPlatform::getPlatform(m, false, true, true, (uint)delay));
-    if (platform == NULL){
-        std::cout << "unsupported platform, exiting." << std::endl;
-        return -1;
-    }else{
-        //std::cout << m->getCPUModel() << " CPU Detected." << std::endl;
-    }
-    uint32 numSockets = m->getNumSockets();
-    max_imc_channels = (pcm::uint32)m->getMCChannelsPerSocket();
-    if (OUT_FILE.size()<1)
-        cout << "Time      ";
-    else
-        append_file("Time");
-
-    if (SHOW_MEMORY){
-        for (uint32 i=0; i<numSockets; ++i) {
-            if (SHOW_CHANNELS){
-                for (uint32 c=0; c<max_imc_channels; ++c){
-                    if (OUT_FILE.size()<1){
-                        cout <<SEP<< "S"<<i<<"C"<<c<<"R" <<SEP<< "S"<<i<<"C"<<c<<"W" ;
-                    }else{
-                        char buf[256];
-                        snprintf(buf, sizeof(buf), ",S%dC%dR,S%dC%dW", i,c,i,c);
-                        append_file(buf);
-                    }
-                }
-            }
-            if (SHOW_MEMORY){
-                if (OUT_FILE.size()<1){
-                    cout <<SEP<< "S"<<i<<"Read" <<SEP<< "S"<<i<<"Write";
-                }else{
-                    char buf[256];
-                    snprintf(buf, sizeof(buf), ",S%dRead,S%dWrite",i,i);
-                    append_file(buf);
-                }
-            }
-        }
+    ecam_setup(result);
+    sampler_setup(m, true);
+
+    string SEP = "    ";
+    std::ofstream file_stream;
+    std::ostream* OUT = &std::cout;
+    if (OUT_FILE.size()>0) {
+        SEP = ",";
+        file_stream.open(OUT_FILE.c_str(), std::ios_base::out);
+        OUT = &file_stream;
     }
-    if (OUT_FILE.size()<1){
-        cout << endl;
-    }else{
-        append_file("\n");
+
+    vector<string> columns = sampler_columns();
+    if (delay < pcie_min_delay()){
+        cerr << "all: -s " << delay << " is below " << pcie_min_delay() << "s, 1 ms per pcie event" << endl;
+        exit(EXIT_FAILURE);
     }
+    trigger_setup(result, columns, pcie_min_delay());
+    alert_setup(result, columns);
+    detect_setup(result, columns);
+    const float coarse = delay;
+    run_setup(result);
+    const bool report = stats_setup(result, columns.size());
+    const vector<string> header = report ? stats_columns(columns) : columns;
+    *OUT << (OUT_FILE.size()<1 ? "Time      " : "Time");
+    for (auto c = header.cbegin(); c != header.cend(); ++c)
+        *OUT << SEP << *c;
+    *OUT << endl;
 
-    ServerUncoreCounterState * BeforeState = new ServerUncoreCounterState[m->getNumSockets()];  //memory
-    ServerUncoreCounterState * AfterState  = new ServerUncoreCounterState[m->getNumSockets()];   //memory
-    uint64 BeforeTime = 0, AfterTime = 0;
-    BeforeTime = m->getTickCount();
+    auto write_row = [&](const vector<double>& row){
+        write_values(*OUT, currentDateTime(), row, OUT_FILE.size()>0);
+        OUT->flush();
+    };
+    vector<double> values, summary;
+    values.reserve(columns.size());
+    summary.reserve(header.size());
     for (;;){
-        if (OUT_FILE.size()<1){
-            cout << currentDateTime();
-        }else{
-            append_file(currentDateTime());
-        }
-        if (SHOW_PCIE){
-            platform->getEvents();//pcie
-            platform->printHeader();
-            platform->printEvents();
-        }
-        for (uint32 i=0; i<numSockets; ++i) {
-            AfterState[i] = m->getServerUncoreCounterState(i);  //memory
-            // m->getPCIeCounterData(skt, ctr);
+        sampler_wait(m, delay);
+        const uint64 elapsed = sampler_read(m, values);
+        if (!report){
+            write_row(values);
+        }else if (stats_add(values, elapsed)){
+            stats_values(summary);
+            write_row(summary);
         }
-        AfterTime = m->getTickCount();
-        printMemBW(numSockets,BeforeState,AfterState,AfterTime-BeforeTime);
-        swap(BeforeTime, AfterTime);
-        swap(BeforeState, AfterState);
-        platform->cleanup();
-        MySleepMs(delay*1000);
+        if (!run_continue(values)) break;
+        delay = trigger_interval(values, coarse);
+    }
+    if (report && stats_pending()){
+        stats_values(summary);
+        write_row(summary);
     }
 
-    delete[] BeforeState;
-    delete[] AfterState;
-    //std::cout << "=====================================" << std::endl;
-    //SystemCounterState before_sstate = getSystemCounterState();
-    //SystemCounterState after_sstate = getSystemCounterState();
-
-    //std::cout << "Instructions per clock:" << getIPC(before_sstate, after_sstate) << std::endl;
-    //std::cout << "Bytes read:" << getBytesReadFromMC(before_sstate, after_sstate) << std::endl;
+    OUT->flush();
+    file_stream.close();
+    run_summary(columns);
+    sampler_cleanup();
     m->cleanup();
     exit(EXIT_SUCCESS);
 }
+
+void usage(){
+    std::cout << "usage: pmt [mem|pcie|all] [options]\n"
+              << "    mem     memory bandwidth per socket/channel (default)\n"
+              << "    pcie    iio bandwidth per pcie device\n"
+              << "    all     memory and pcie sampled in the same pass, one row per interval\n"
+              << "    daemon  one collector serving subscribers over a unix socket\n"
+              << "    flight  keep the last minutes in memory, dump on SIGUSR1\n"
+              << "    hires   imc channels every 100us+ into a binary file\n"
+              << "    record  save raw counter deltas and topology\n"
+              << "    replay  run a record through the rate, stats and output code\n"
+              << "    core    per core IPC, L3 misses and DRAM traffic, busiest cores only\n"
+              << "    mba     hold socket/group bandwidth at a target by throttling resctrl groups\n"
+              << "run 'pmt <command> -h' for the options of each command" << std::endl;
+}
+
+int main(int argc, char** argv) {
+#ifdef PMT_BENCH
+    return bench_main(argc, argv);
+#endif
+    // the old mem and pcie binaries are symlinks to pmt
+    const char* base = strrchr(argv[0], '/');
+    string self = base ? base + 1 : argv[0];
+    if (self == "mem")  return mem_main(argc, argv);
+    if (self == "pcie") return pcie_main(argc, argv);
+
+    if (argc > 1 && argv[1][0] != '-'){
+        string cmd = argv[1];
+        if (cmd == "mem")  return mem_main(argc - 1, argv + 1);
+        if (cmd == "pcie") return pcie_main(argc - 1, argv + 1);
+        if (cmd == "all")  return all_main(argc - 1, argv + 1);
+        if (cmd == "daemon") return daemon_main(argc - 1, argv + 1);
+        if (cmd == "flight") return flight_main(argc - 1, argv + 1);
+        if (cmd == "hires")  return hires_main(argc - 1, argv + 1);
+        if (cmd == "record") return record_main(argc - 1, argv + 1);
+        if (cmd == "replay") return replay_main(argc - 1, argv + 1);
+        if (cmd == "core")   return core_main(argc - 1, argv + 1);
+        if (cmd == "mba")    return mba_main(argc - 1, argv + 1);
+        usage();
+        return 1;
+    }
+    return mem_main(argc, argv);
+}
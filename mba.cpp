@@ -0,0 +1,423 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Closed loop MBA: hold each socket's IMC read+write bandwidth, and with
+// --group-target a group's own MBM bandwidth, at a target by moving the MB
+// schemata percentage of the --throttle groups. Every socket and every
+// group/socket pair runs a velocity form PI loop on the relative error
+//   err = (measured - target) / target
+//   pct -= 100 * (kp * (err - last_err) + ki * err)
+// held while err is inside +-band (hysteresis), moved at most --max-step
+// points per interval and snapped to the granularity in info/MB. A group
+// gets the lowest percentage of its socket loop and its own loop. Throttling
+// is written at once, a release only one granularity step per --hold
+// intervals so the loop doesn't chatter between two steps that straddle the
+// target. Groups are put back to 100% at exit. The MB domain id is taken as the socket.
+// --simulate builds a fake resctrl tree and drives it with a plant model.
+struct pi_loop{
+    double target;      // MB/s, 0 is off
+    double pct;
+    double last_err;
+    void reset(double t){ target = t; pct = 100; last_err = 0; }
+    void update(double measured);
+};
+
+struct mba_group{
+    string name, dir;
+    vector<pi_loop> loops;      // own MBM target, per domain
+    vector<int> written;        // percentage last written, per domain
+    int since_write;            // intervals since the last schemata write
+    vector<uint64> bytes;       // mbm_total_bytes at the last read
+    vector<double> mbps;
+};
+
+static string root = "/sys/fs/resctrl";
+static vector<int> domains;
+static vector<pi_loop> socket_loops;
+static vector<mba_group> groups;
+static double kp = 0.5, ki = 0.3, band = 0.05, max_step = 10;
+static int min_pct = 10, gran = 10, hold = 3;
+
+void pi_loop::update(double measured){
+    if (target <= 0) return;
+    const double err = (measured - target) / target;
+    if (fabs(err) <= band){
+        last_err = err;
+        return;
+    }
+    double step = -100 * (kp * (err - last_err) + ki * err);
+    step = (std::max)(-max_step, (std::min)(max_step, step));
+    pct = (std::max)((double)min_pct, (std::min)(100.0, pct + step));
+    last_err = err;
+}
+
+static int snap(double pct){
+    const int q = (int)(pct / gran + 0.5) * gran;
+    return (std::max)(min_pct, (std::min)(100, q));
+}
+
+// "MB:0=70;1=100" of a schemata file, domain -> value
+static map<int, int> read_schemata(const string& dir){
+    map<int, int> mb;
+    std::ifstream in((dir + "/schemata").c_str());
+    string line;
+    while (getline(in, line)){
+        const size_t p = line.find_first_not_of(" \t");
+        if (p == string::npos || line.compare(p, 3, "MB:") != 0) continue;
+        stringstream ss(line.substr(p + 3));
+        string item;
+        while (getline(ss, item, ';')){
+            const size_t eq = item.find('=');
+            if (eq != string::npos)
+                mb[atoi(item.c_str())] = atoi(item.c_str() + eq + 1);
+        }
+    }
+    return mb;
+}
+
+static bool write_schemata(mba_group& g, const vector<int>& pct){
+    string line = "MB:";
+    for (size_t d = 0; d < domains.size(); d++)
+        line += (d ? ";" : "") + std::to_string(domains[d]) + "=" + std::to_string(pct[d]);
+    std::ofstream out((g.dir + "/schemata").c_str());
+    out << line << "\n";
+    out.close();
+    if (out.fail()){
+        cerr << "mba: can't write " << g.dir << "/schemata: " << strerror(errno) << endl;
+        return false;
+    }
+    if (DEBUG) cerr << "mba: " << g.name << " " << line << endl;
+    g.written = pct;
+    g.since_write = 0;
+    return true;
+}
+
+static string mbm_file(const mba_group& g, size_t d){
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/mon_data/mon_L3_%02d", domains[d]);
+    return g.dir + buf + "/mbm_total_bytes";
+}
+
+static void read_mbm(mba_group& g, double seconds){
+    for (size_t d = 0; d < domains.size(); d++){
+        const uint64 bytes = resctrl_counter(mbm_file(g, d));
+        g.mbps[d] = bytes >= g.bytes[d] && seconds > 0 ? (bytes - g.bytes[d]) / 1000000.0 / seconds : 0;
+        g.bytes[d] = bytes;
+    }
+}
+
+// "40000" for every socket or "0=40000,1=30000"
+static vector<double> parse_targets(const string& s, size_t n){
+    vector<double> targets(n, 0.0);
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')){
+        const size_t eq = item.find('=');
+        if (eq == string::npos){
+            std::fill(targets.begin(), targets.end(), atof(item.c_str()));
+            continue;
+        }
+        const int id = atoi(item.c_str());
+        for (size_t d = 0; d < n; d++)
+            if (domains[d] == id) targets[d] = atof(item.c_str() + eq + 1);
+    }
+    return targets;
+}
+
+// --simulate: each socket carries sim_base MB/s of its own plus every group's
+// sim_demand scaled by the group's MB percentage, reached through a first
+// order lag with +-2% noise. The plant reads the schemata and advances the
+// mbm_total_bytes of the fake tree, so the controller sees the same files a
+// real mount would give it.
+static double sim_base = 20000, sim_demand = 40000;
+static vector<double> sim_bw;       // [group * domains + domain]
+
+static void mkdirs(const string& path){
+    for (size_t p = path.find('/', 1); ; p = path.find('/', p + 1)){
+        mkdir(path.substr(0, p).c_str(), 0755);
+        if (p == string::npos) break;
+    }
+}
+
+// the fake tree goes to a fresh temporary directory unless --resctrl-root
+// names one, and never into a real resctrl mount: the plant writes L3/MB
+// schemata and mbm_total_bytes as if it owned the files
+static const long resctrl_magic = 0x7655821;     // RDTGROUP_SUPER_MAGIC
+
+static void sim_root(const cxxopts::ParseResult& result){
+    if (!result.count("resctrl-root")){
+        char tmpl[] = "/tmp/pmt-mba-sim.XXXXXX";
+        if (!mkdtemp(tmpl)){
+            cerr << "mba: can't create a directory for --simulate: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        root = tmpl;
+        cerr << "mba: simulating under " << root << endl;
+        return;
+    }
+    // the root may not exist yet, its nearest existing parent decides
+    string p = root;
+    struct statfs fs;
+    while (statfs(p.c_str(), &fs) != 0){
+        const size_t slash = p.find_last_of('/');
+        p = slash == string::npos ? "." : slash == 0 ? "/" : p.substr(0, slash);
+    }
+    if ((long)fs.f_type == resctrl_magic){
+        cerr << "mba: " << root << " is on a resctrl mount, --simulate needs a scratch directory" << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void sim_setup(uint32 sockets, const vector<string>& names){
+    mkdirs(root + "/info/MB");
+    std::ofstream(root + "/info/MB/min_bandwidth") << "10\n";
+    std::ofstream(root + "/info/MB/bandwidth_gran") << "10\n";
+    for (auto n = names.cbegin(); n != names.cend(); ++n){
+        const string dir = root + "/" + *n;
+        string l3 = "L3:", mb = "MB:";
+        for (uint32 s = 0; s < sockets; s++){
+            char buf[32];
+            snprintf(buf, sizeof(buf), "/mon_data/mon_L3_%02d", s);
+            mkdirs(dir + buf);
+            std::ofstream(dir + buf + "/mbm_total_bytes") << "0\n";
+            l3 += (s ? ";" : "") + std::to_string(s) + "=7ff";
+            mb += (s ? ";" : "") + std::to_string(s) + "=100";
+        }
+        std::ofstream(dir + "/schemata") << "    " << l3 << "\n    " << mb << "\n";
+    }
+}
+
+static void sim_step(double seconds, vector<double>& socket_mbps){
+    socket_mbps.assign(domains.size(), sim_base);
+    sim_bw.resize(groups.size() * domains.size(), 0.0);
+    for (size_t i = 0; i < groups.size(); i++){
+        map<int, int> mb = read_schemata(groups[i].dir);
+        for (size_t d = 0; d < domains.size(); d++){
+            double& bw = sim_bw[i * domains.size() + d];
+            bw += 0.5 * (sim_demand * mb[domains[d]] / 100.0 - bw);
+            const double moved = bw * (1 + (rand() % 401 - 200) / 10000.0);
+            socket_mbps[d] += moved;
+            const string file = mbm_file(groups[i], d);
+            const uint64 bytes = resctrl_counter(file) + (uint64)(moved * 1000000 * seconds);
+            std::ofstream(file.c_str()) << bytes << "\n";
+        }
+    }
+}
+
+int mba_main(int argc, char** argv) {
+    cxxopts::Options options("mba", "closed loop memory bandwidth allocation for low priority resctrl groups");
+    options.add_options()
+        ("g,debug",       "Print every schemata write", cxxopts::value<bool>()->default_value("false"))
+        ("o,output",      "Write to csv file",    cxxopts::value<string>()->default_value(""))
+        ("s,delay",       "Seconds/update",       cxxopts::value<float>()->default_value("1.0"))
+        ("throttle",      "resctrl control groups to throttle, comma separated", cxxopts::value<string>()->default_value(""))
+        ("target",        "Socket read+write MB/s: 40000 for all, or 0=40000,1=30000", cxxopts::value<string>()->default_value(""))
+        ("group-target",  "Per socket MBM MB/s of a throttled group: batch=5000,etl=2000", cxxopts::value<string>()->default_value(""))
+        ("kp",            "Proportional gain, % per unit of relative error", cxxopts::value<double>()->default_value("0.5"))
+        ("ki",            "Integral gain, % per unit of relative error and interval", cxxopts::value<double>()->default_value("0.3"))
+        ("band",          "Hold while within this % of the target", cxxopts::value<double>()->default_value("5"))
+        ("max-step",      "Most percentage points moved per interval", cxxopts::value<double>()->default_value("10"))
+        ("hold",          "Intervals between two release steps of a group", cxxopts::value<int>()->default_value("3"))
+        ("resctrl-root",  "resctrl mount point",  cxxopts::value<string>()->default_value("/sys/fs/resctrl"))
+        ("simulate",      "Build a fake tree of this many sockets and run a plant model, under --resctrl-root if given (never a resctrl mount), else a new /tmp directory", cxxopts::value<int>()->default_value("0"))
+        ("sim-base",      "Simulated MB/s per socket of the protected workload", cxxopts::value<double>()->default_value("20000"))
+        ("sim-demand",    "Simulated MB/s per socket each throttled group wants", cxxopts::value<double>()->default_value("40000"))
+        ("h,help",        "Print usage")
+    ;
+    add_run_options(options);
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    DEBUG = result["debug"].as<bool>();
+    OUT_FILE = result["output"].as<string>();
+    delay = result["delay"].as<float>();
+    root = result["resctrl-root"].as<string>();
+    kp = result["kp"].as<double>();
+    ki = result["ki"].as<double>();
+    band = result["band"].as<double>() / 100;
+    max_step = (std::max)(1.0, result["max-step"].as<double>());
+    hold = (std::max)(1, result["hold"].as<int>());
+    const int simulate = (std::max)(0, result["simulate"].as<int>());
+    sim_base = result["sim-base"].as<double>();
+    sim_demand = result["sim-demand"].as<double>();
+
+    vector<string> names;
+    stringstream ss(result["throttle"].as<string>());
+    string item;
+    while (getline(ss, item, ','))
+        if (item.size()) names.push_back(item);
+    if (names.empty() || (result["target"].as<string>().empty() && result["group-target"].as<string>().empty())){
+        cerr << "mba: needs --throttle and a --target or --group-target" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (simulate){
+        sim_root(result);
+        sim_setup(simulate, names);
+    }
+
+    for (auto n = names.cbegin(); n != names.cend(); ++n){
+        mba_group g;
+        g.name = *n;
+        g.dir = root + "/" + *n;
+        map<int, int> mb = read_schemata(g.dir);
+        if (mb.empty()){
+            cerr << "mba: no MB line in " << g.dir << "/schemata, is " << *n << " a control group on a cpu with MBA?" << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (domains.empty())
+            for (auto d = mb.cbegin(); d != mb.cend(); ++d)
+                domains.push_back(d->first);
+        groups.push_back(g);
+    }
+    if (resctrl_counter(root + "/info/MB/min_bandwidth"))
+        min_pct = (int)resctrl_counter(root + "/info/MB/min_bandwidth");
+    if (resctrl_counter(root + "/info/MB/bandwidth_gran"))
+        gran = (int)resctrl_counter(root + "/info/MB/bandwidth_gran");
+
+    const size_t nd = domains.size();
+    const vector<double> targets = parse_targets(result["target"].as<string>(), nd);
+    socket_loops.resize(nd);
+    for (size_t d = 0; d < nd; d++)
+        socket_loops[d].reset(targets[d]);
+    map<string, double> group_targets;
+    stringstream gs(result["group-target"].as<string>());
+    while (getline(gs, item, ',')){
+        const size_t eq = item.find('=');
+        if (eq != string::npos)
+            group_targets[item.substr(0, eq)] = atof(item.c_str() + eq + 1);
+    }
+    for (auto g = groups.begin(); g != groups.end(); ++g){
+        g->loops.resize(nd);
+        for (size_t d = 0; d < nd; d++)
+            g->loops[d].reset(group_targets.count(g->name) ? group_targets[g->name] : 0);
+        g->bytes.assign(nd, 0);
+        g->mbps.assign(nd, 0.0);
+        if (!write_schemata(*g, vector<int>(nd, 100)))
+            exit(EXIT_FAILURE);
+    }
+
+    PCM *m = NULL;
+    if (!simulate){
+        m = PCM::getInstance();
+        PCM::ErrorCode returnResult = m->program();
+        if (returnResult != PCM::Success) {
+            std::cerr << "PCM couldn't start" << std::endl;
+            std::cerr << "Error code: " << returnResult << std::endl;
+            exit(1);
+        }
+        imc_setup(m);
+        if (m->getNumSockets() < nd)
+            cerr << "mba: " << nd << " MB domains but " << m->getNumSockets() << " sockets, extra domains read 0" << endl;
+    }
+
+    vector<string> columns;
+    for (size_t d = 0; d < nd; d++){
+        columns.push_back("S" + std::to_string(domains[d]) + "MB");
+        columns.push_back("S" + std::to_string(domains[d]) + "Target");
+    }
+    for (auto g = groups.cbegin(); g != groups.cend(); ++g){
+        for (size_t d = 0; d < nd; d++){
+            columns.push_back(g->name + "_S" + std::to_string(domains[d]) + "MB");
+            columns.push_back(g->name + "_S" + std::to_string(domains[d]) + "Pct");
+        }
+    }
+    std::ofstream file_stream;
+    std::ostream* OUT = &std::cout;
+    if (OUT_FILE.size()>0) {
+        file_stream.open(OUT_FILE.c_str(), std::ios_base::out);
+        OUT = &file_stream;
+    }
+    const bool csv = OUT_FILE.size()>0;
+    *OUT << "Time";
+    for (auto c = columns.cbegin(); c != columns.cend(); ++c)
+        *OUT << (csv ? "," : "    ") << *c;
+    *OUT << "\n";
+
+    imc_state before, after;
+    vector<uint64> reads, writes;
+    vector<double> socket_mbps(nd, 0.0), values;
+    vector<int> pct(nd), top(nd);
+    run_setup(result);
+    if (m) imc_read(before);
+    for (auto g = groups.begin(); g != groups.end(); ++g)
+        read_mbm(*g, 0);
+    uint64 beforeTime = m ? m->getTickCount() : 0;
+    for (;;){
+        MySleepMs(int(delay * 1000));
+        double seconds = delay;
+        if (m){
+            imc_read(after);
+            const uint64 afterTime = m->getTickCount();
+            seconds = (afterTime - beforeTime) / 1000.0;
+            beforeTime = afterTime;
+            imc_deltas(before, after, reads, writes);
+            const uint32 channels = mem_channels();
+            for (size_t d = 0; d < nd; d++){
+                uint64 lines = 0;
+                for (uint32 c = 0; (uint32)domains[d] < m->getNumSockets() && c < channels; c++)
+                    lines += reads[domains[d] * channels + c] + writes[domains[d] * channels + c];
+                socket_mbps[d] = seconds > 0 ? lines * 64 / 1000000.0 / seconds : 0;
+            }
+            swap(before, after);
+        }else{
+            sim_step(seconds, socket_mbps);
+        }
+
+        values.clear();
+        for (size_t d = 0; d < nd; d++){
+            socket_loops[d].update(socket_mbps[d]);
+            values.push_back(roundf(socket_mbps[d] * 100) / 100);
+            values.push_back(socket_loops[d].target);
+        }
+        // loops don't run ahead of what the hold let through (anti-windup)
+        top.assign(nd, min_pct);
+        for (auto g = groups.begin(); g != groups.end(); ++g){
+            read_mbm(*g, seconds);
+            for (size_t d = 0; d < nd; d++){
+                g->loops[d].update(g->mbps[d]);
+                pct[d] = snap((std::min)(socket_loops[d].pct, g->loops[d].pct));
+                if (pct[d] > g->written[d])
+                    pct[d] = g->since_write + 1 >= hold ? (std::min)(pct[d], g->written[d] + gran) : g->written[d];
+                g->loops[d].pct = (std::min)(g->loops[d].pct, (double)pct[d] + gran);
+                top[d] = (std::max)(top[d], pct[d]);
+                values.push_back(roundf(g->mbps[d] * 100) / 100);
+                values.push_back(pct[d]);
+            }
+            g->since_write++;
+            if (pct != g->written)
+                write_schemata(*g, pct);
+        }
+        for (size_t d = 0; d < nd; d++)
+            socket_loops[d].pct = (std::min)(socket_loops[d].pct, (double)top[d] + gran);
+        write_values(*OUT, currentDateTime(), values, csv);
+        OUT->flush();
+        if (!run_continue(values)) break;
+    }
+
+    for (auto g = groups.begin(); g != groups.end(); ++g)
+        write_schemata(*g, vector<int>(nd, 100));
+    file_stream.close();
+    run_summary(columns);
+    if (m) m->cleanup();
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,539 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <time.h>
+#include <chrono>
+#include <map>
+#include <math.h>
+#include <fstream>
+#include "pcm-pcie.h"
+#include "pmt.h"
+//pcm-raw -e imc/config=0x09,name=ECC_CORRECTABLE_ERRORS/
+//https://github.com/Chester-Gillon/pcm
+
+using namespace std;
+using namespace pcm;
+
+static ofstream OUT;
+bool SHOW_CHANNELS=false;
+bool SHOW_MEMORY=false;
+bool SHOW_LATENCY=false;
+bool SHOW_UPI=false;
+bool SHOW_ENERGY=false;
+bool SHOW_RESCTRL=false;
+static uint32 upi_links=0;
+bool SHOW_PCIE=false;
+static bool pcie_window=false;     // -p read with the IMC, else pcm-pcie's own pass
+string SEP="    ";
+constexpr uint32 max_sockets = 256;
+uint32 max_imc_channels = ServerUncoreCounterState::maxChannels;
+const uint32 max_edc_channels = ServerUncoreCounterState::maxChannels;
+const uint32 max_imc_controllers = ServerUncoreCounterState::maxControllers;
+const uint64 imc_counter_mask = (1ULL << 48) - 1;  // IMC counters are 48 bits wide
+
+void empty_output(){
+    std::ofstream out(OUT_FILE);
+    out << "";
+    out.close();
+}
+void append_file(string data){
+    //OUT.open(OUT_FILE, ios_base::app);
+    //if (OUT.is_open()){
+        //cout<<"data("<<data.size() <<")="<<data<<endl;
+        //OUT.write(data.data(), data.size());
+        OUT << data;
+        OUT.flush();
+    //}
+}
+
+IPlatform *IPlatform::getPlatform(PCM *m, bool csv, bool bw, bool verbose, uint32 delay){
+    switch (m->getCPUModel()) {
+	case PCM::SPR:
+            return new EagleStreamPlatform(m, csv, bw, verbose, delay);
+        case PCM::ICX:
+        case PCM::SNOWRIDGE:
+            return new WhitleyPlatform(m, csv, bw, verbose, delay);
+        case PCM::SKX:
+            //return new PurleyPlatform(m, csv, bw, verbose, delay);
+        case PCM::BDX_DE:
+        case PCM::BDX:
+        case PCM::KNL:
+        case PCM::HASWELLX:
+            //return new GrantleyPlatform(m, csv, bw, verbose, delay);
+        case PCM::IVYTOWN:
+        case PCM::JAKETOWN:
+            //return new BromolowPlatform(m, csv, bw, verbose, delay);
+        default:
+          return NULL;
+    }
+}
+
+void mem_setup(PCM *m){
+    max_imc_channels = (pcm::uint32)m->getMCChannelsPerSocket();
+}
+
+void mem_setup(uint32 channels){
+    max_imc_channels = channels;
+}
+
+uint32 mem_channels(){
+    return max_imc_channels;
+}
+
+vector<string> mem_columns(uint32 numSockets){
+    vector<string> columns;
+    if (!SHOW_MEMORY) return columns;
+    char buf[64];
+    for (uint32 i=0; i<numSockets; ++i) {
+        if (SHOW_CHANNELS){
+            for (uint32 c=0; c<max_imc_channels; ++c){
+                snprintf(buf, sizeof(buf), "S%dC%dR", i, c);
+                columns.push_back(buf);
+                snprintf(buf, sizeof(buf), "S%dC%dW", i, c);
+                columns.push_back(buf);
+            }
+        }
+        snprintf(buf, sizeof(buf), "S%dRead", i);
+        columns.push_back(buf);
+        snprintf(buf, sizeof(buf), "S%dWrite", i);
+        columns.push_back(buf);
+        for (uint32 l=0; l<upi_links && SHOW_UPI; ++l){
+            static const char* dirs[4] = {"In", "Out", "InUtil", "OutUtil"};
+            for (int d=0; d<4; d++){
+                snprintf(buf, sizeof(buf), "S%dU%d%s", i, l, dirs[d]);
+                columns.push_back(buf);
+            }
+        }
+    }
+    for (uint32 i=0; i<numSockets && SHOW_LATENCY; ++i) {
+        if (SHOW_CHANNELS){
+            for (uint32 c=0; c<max_imc_channels; ++c){
+                snprintf(buf, sizeof(buf), "S%dC%dRL", i, c);
+                columns.push_back(buf);
+                snprintf(buf, sizeof(buf), "S%dC%dWL", i, c);
+                columns.push_back(buf);
+            }
+        }
+        snprintf(buf, sizeof(buf), "S%dReadLat", i);
+        columns.push_back(buf);
+        snprintf(buf, sizeof(buf), "S%dWriteLat", i);
+        columns.push_back(buf);
+    }
+    if (SHOW_ENERGY){
+        vector<string> energy = energy_columns(numSockets);
+        columns.insert(columns.end(), energy.begin(), energy.end());
+    }
+    if (SHOW_RESCTRL){
+        vector<string> groups = resctrl_columns();
+        columns.insert(columns.end(), groups.begin(), groups.end());
+    }
+    if (pcie_window){
+        vector<string> pcie = pcie_columns();
+        columns.insert(columns.end(), pcie.begin(), pcie.end());
+    }
+    return columns;
+}
+
+// Our own handles on the IMC boxes PCM::program() already programmed: a read
+// touches only the configured channel counters, not the whole uncore state
+// getServerUncoreCounterState() fills in (EDC, M2M, UPI, PCU, energy ...).
+// That holds in PCI config mode only, where a second handle reads the same
+// box registers. With the perf uncore backend (PCM_USE_UNCORE_PERF, or pcm
+// falling back to perf under lockdown) the counters are perf events owned by
+// PCM's own boxes and a new handle would read nothing programmed, so there
+// imc stays empty and imc_read() goes through getServerUncoreCounterState().
+static vector<std::unique_ptr<ServerPCICFGUncore>> imc;
+static PCM *imc_pcm = NULL;
+static uint32 imc_sockets = 0;
+
+void imc_setup(PCM *m){
+    mem_setup(m);
+    upi_links = SHOW_UPI ? m->getQPILinksPerSocket() : 0;
+    imc_pcm = m;
+    imc_sockets = m->getNumSockets();
+    imc.clear();
+    if (m->useLinuxPerfForUncore()){
+        if (DEBUG) cerr << "imc: perf uncore backend, reading through pcm" << endl;
+        return;
+    }
+    for (uint32 i=0; i<imc_sockets; ++i)
+        imc.push_back(std::unique_ptr<ServerPCICFGUncore>(new ServerPCICFGUncore(i, m)));
+}
+
+// With --latency the IMC runs programServerUncoreLatencyMetrics(): counter
+// 0/1 are RPQ occupancy/inserts, 2/3 WPQ occupancy/inserts, so reads and
+// writes are the queue inserts (one 64B line each) of the same window.
+void imc_read(uint32 socket, imc_state& s){
+    const size_t n = (size_t)imc_sockets * max_imc_channels;
+    if (s.reads.size() != n){
+        s.reads.assign(n, 0);
+        s.writes.assign(n, 0);
+        if (SHOW_LATENCY){
+            s.read_occ.assign(n, 0);
+            s.write_occ.assign(n, 0);
+            s.clocks.assign(n, 0);
+        }
+    }
+    const size_t base = socket * max_imc_channels;
+    if (imc.empty()){
+        // counts since zero are the raw counter values
+        const ServerUncoreCounterState zero, u = imc_pcm->getServerUncoreCounterState(socket);
+        for (uint32 channel=0; channel<max_imc_channels; ++channel){
+            if (SHOW_LATENCY){
+                s.read_occ [base + channel] = getMCCounter(channel, 0, zero, u);
+                s.reads    [base + channel] = getMCCounter(channel, 1, zero, u);
+                s.write_occ[base + channel] = getMCCounter(channel, 2, zero, u);
+                s.writes   [base + channel] = getMCCounter(channel, 3, zero, u);
+                s.clocks   [base + channel] = getDRAMClocks(channel, zero, u);
+            }else{
+                s.reads [base + channel] = getMCCounter(channel, 0, zero, u);
+                s.writes[base + channel] = getMCCounter(channel, 1, zero, u);
+            }
+        }
+        return;
+    }
+    ServerPCICFGUncore* u = imc[socket].get();
+    u->freezeCounters();
+    if (SHOW_LATENCY){
+        for (uint32 channel=0; channel<max_imc_channels; ++channel){
+            s.read_occ [base + channel] = u->getMCCounter(channel, 0);
+            s.reads    [base + channel] = u->getMCCounter(channel, 1);
+            s.write_occ[base + channel] = u->getMCCounter(channel, 2);
+            s.writes   [base + channel] = u->getMCCounter(channel, 3);
+            s.clocks   [base + channel] = u->getDRAMClocks(channel);
+        }
+    }else{
+        for (uint32 channel=0; channel<max_imc_channels; ++channel){
+            s.reads [base + channel] = u->getMCCounter(channel, 0);
+            s.writes[base + channel] = u->getMCCounter(channel, 1);
+        }
+    }
+    u->unfreezeCounters();
+}
+
+void imc_read(imc_state& s){
+    for (uint32 i=0; i<imc_sockets; ++i)
+        imc_read(i, s);
+}
+
+// raw CAS counts of one window, [socket * max_imc_channels + channel]
+void imc_deltas(const imc_state& before, const imc_state& after, vector<uint64>& reads, vector<uint64>& writes){
+    const size_t n = after.reads.size();
+    reads.resize(n);
+    writes.resize(n);
+    rate_delta(before.reads.data(), after.reads.data(), reads.data(), n, imc_counter_mask);
+    rate_delta(before.writes.data(), after.writes.data(), writes.data(), n, imc_counter_mask);
+}
+
+// MB/s in mem_columns() order from imc_deltas() counts: the channel and
+// socket rates are each one rate_scale() pass, then interleaved
+void mem_rates(uint32 numSockets, const vector<uint64>& channelReads, const vector<uint64>& channelWrites, const uint64 elapsedTime, vector<double>& values){
+    static vector<uint64> skt;           // socket reads, then socket writes
+    static vector<double> rd, wr, skt_bw;
+    if (!SHOW_MEMORY) return;
+    const double k = elapsedTime ? 64 / 1000000.0 / (elapsedTime / 1000.0) : 0;
+    const size_t n = (size_t)numSockets * max_imc_channels;
+    skt.assign(2 * numSockets, 0);
+    for (uint32 i=0; i<numSockets; ++i) {
+        for (uint32 channel=0; channel<max_imc_channels; ++channel){
+            skt[i] += channelReads[i * max_imc_channels + channel];
+            skt[numSockets + i] += channelWrites[i * max_imc_channels + channel];
+        }
+    }
+    skt_bw.resize(skt.size());
+    rate_scale(skt.data(), skt_bw.data(), skt.size(), k);
+    if (SHOW_CHANNELS){
+        rd.resize(n);
+        wr.resize(n);
+        rate_scale(channelReads.data(), rd.data(), n, k);
+        rate_scale(channelWrites.data(), wr.data(), n, k);
+    }
+    for (uint32 i=0; i<numSockets; ++i) {
+        if (SHOW_CHANNELS){
+            for (uint32 channel=0; channel<max_imc_channels; ++channel){
+                values.push_back(rd[i * max_imc_channels + channel]);
+                values.push_back(wr[i * max_imc_channels + channel]);
+            }
+        }
+        values.push_back(skt_bw[i]);
+        values.push_back(skt_bw[numSockets + i]);
+    }
+}
+
+// ns a request spends in the RPQ/WPQ, Little's law over the window: the
+// occupancy counter adds the queue depth every DRAM clock, so occupancy /
+// inserts is the clocks per request, scaled by the measured clock period.
+void mem_latency(uint32 numSockets, const imc_state& before, const imc_state& after, const uint64 elapsedTime, vector<double>& values){
+    auto toNs = [](double occ_ns, double inserts){
+        return inserts > 0 ? nearbyint(occ_ns / inserts * 100) / 100 : 0.0;
+    };
+    static vector<uint64> d;     // clocks, read_occ, write_occ, reads, writes
+    const size_t n = after.clocks.size();
+    d.resize(5 * n);
+    rate_delta(before.clocks.data(), after.clocks.data(), d.data(), n, imc_counter_mask);
+    rate_delta(before.read_occ.data(), after.read_occ.data(), d.data() + n, n, imc_counter_mask);
+    rate_delta(before.write_occ.data(), after.write_occ.data(), d.data() + 2 * n, n, imc_counter_mask);
+    rate_delta(before.reads.data(), after.reads.data(), d.data() + 3 * n, n, imc_counter_mask);
+    rate_delta(before.writes.data(), after.writes.data(), d.data() + 4 * n, n, imc_counter_mask);
+    for (uint32 i=0; i<numSockets; ++i) {
+        double sktReadOcc=0, sktWriteOcc=0, sktReads=0, sktWrites=0;
+        for (uint32 channel=0; channel<max_imc_channels; ++channel){
+            const size_t c = i * max_imc_channels + channel;
+            const uint64 clocks = d[c];
+            const double clock_ns = clocks ? elapsedTime * 1000000.0 / clocks : 0;
+            const double readOcc  = d[n + c] * clock_ns;
+            const double writeOcc = d[2 * n + c] * clock_ns;
+            const double reads  = (double)d[3 * n + c];
+            const double writes = (double)d[4 * n + c];
+            sktReadOcc += readOcc;
+            sktWriteOcc += writeOcc;
+            sktReads += reads;
+            sktWrites += writes;
+            if (SHOW_CHANNELS){
+                values.push_back(toNs(readOcc, reads));
+                values.push_back(toNs(writeOcc, writes));
+            }
+        }
+        values.push_back(toNs(sktReadOcc, sktReads));
+        values.push_back(toNs(sktWriteOcc, sktWrites));
+    }
+}
+
+// UPI data in/out of every link in MB/s and % of the link's capacity,
+// appended for one socket from the SystemCounterState taken with the IMC reads
+void mem_upi(uint32 socket, const imc_state& before, const imc_state& after, const uint64 elapsedTime, vector<double>& values){
+    auto toBW = [&elapsedTime](const uint64 bytes){
+        float val=(bytes / 1000000.0 / (elapsedTime / 1000.0));
+        return roundf(val * 100) / 100;
+    };
+    for (uint32 l=0; l<upi_links; ++l){
+        values.push_back(toBW(getIncomingQPILinkBytes(socket, l, before.upi, after.upi)));
+        values.push_back(toBW(getOutgoingQPILinkBytes(socket, l, before.upi, after.upi)));
+        values.push_back(roundf(getIncomingQPILinkUtilization(socket, l, before.upi, after.upi) * 10000) / 100);
+        values.push_back(roundf(getOutgoingQPILinkUtilization(socket, l, before.upi, after.upi) * 10000) / 100);
+    }
+}
+
+void mem_values(uint32 numSockets, const imc_state& before, const imc_state& after, const uint64 elapsedTime, vector<double>& values){
+    static vector<uint64> reads, writes;
+    static vector<double> rates;
+    imc_deltas(before, after, reads, writes);
+    if (!SHOW_UPI || !SHOW_MEMORY){
+        mem_rates(numSockets, reads, writes, elapsedTime, values);
+    }else{
+        // each socket's UPI links go right after its Read/Write
+        rates.clear();
+        mem_rates(numSockets, reads, writes, elapsedTime, rates);
+        const size_t per = (SHOW_CHANNELS ? 2 * max_imc_channels : 0) + 2;
+        for (uint32 i=0; i<numSockets; ++i){
+            values.insert(values.end(), rates.begin() + i * per, rates.begin() + (i + 1) * per);
+            mem_upi(i, before, after, elapsedTime, values);
+        }
+    }
+    if (SHOW_LATENCY && SHOW_MEMORY)
+        mem_latency(numSockets, before, after, elapsedTime, values);
+    if (SHOW_ENERGY){
+        static vector<double> socket_mbps;
+        socket_mbps.assign(numSockets, 0.0);
+        for (uint32 i=0; i<numSockets; ++i){
+            uint64 lines = 0;
+            for (uint32 channel=0; channel<max_imc_channels; ++channel)
+                lines += reads[i * max_imc_channels + channel] + writes[i * max_imc_channels + channel];
+            socket_mbps[i] = elapsedTime ? lines * 64 / 1000000.0 / (elapsedTime / 1000.0) : 0;
+        }
+        energy_values(numSockets, before.energy, after.energy, elapsedTime, socket_mbps, values);
+    }
+    if (SHOW_RESCTRL)
+        resctrl_values(before.mbm, after.mbm, elapsedTime, values);
+    if (pcie_window)
+        pcie_window_values(before.iio, after.iio, elapsedTime, values);
+}
+
+void printMemBW(uint32 numSockets, const imc_state& before, const imc_state& after, const uint64 elapsedTime, vector<double>& values){
+    values.clear();
+    mem_values(numSockets, before, after, elapsedTime, values);
+    uint64 t = overhead_clock();
+    string row;
+    char buf[64];
+    for (auto v = values.cbegin(); v != values.cend(); ++v){
+        if (OUT_FILE.size()<1){
+            snprintf(buf, sizeof(buf), "%s%6g", SEP.c_str(), *v);
+        }else{
+            snprintf(buf, sizeof(buf), ",%.2f", *v);
+        }
+        row += buf;
+    }
+    row += "\n";
+    overhead_add(OVERHEAD_FORMAT, t);
+
+    t = overhead_clock();
+    if (OUT_FILE.size()<1){
+        cout << row << flush;
+    }else{
+        append_file(row);
+    }
+    overhead_add(OVERHEAD_WRITE, t);
+}
+
+int mem_main(int argc, char** argv) {
+    cxxopts::Options options("mem", "memory bandwidth monitor tool");
+    options.add_options()
+        ("g,debug",   "Enable debug info",    cxxopts::value<bool>()->default_value("false"))
+        ("v,version", "Version output",       cxxopts::value<bool>()->default_value("false"))
+        ("o,output",  "Write to csv file",    cxxopts::value<string>()->default_value(""))
+        ("s,delay",   "Seconds/update",       cxxopts::value<float>()->default_value("1.0"))
+        ("m,memory",  "Show memory bandwidth",cxxopts::value<bool>()->default_value("true"))
+        ("c,channels","Show memory channels", cxxopts::value<bool>()->default_value("false"))
+        ("p,pcie",    "Show pcie bandwidth",  cxxopts::value<bool>()->default_value("false"))
+        ("latency",   "Show DRAM read/write latency (ns) from RPQ/WPQ occupancy", cxxopts::value<bool>()->default_value("false"))
+        ("u,upi",     "Show UPI link MB/s and utilization % per socket", cxxopts::value<bool>()->default_value("false"))
+        ("e,energy",  "Show package/DRAM watts and GB/s per watt per socket", cxxopts::value<bool>()->default_value("false"))
+        ("h,help",    "Print usage")
+    ;
+    add_trigger_options(options);
+    add_run_options(options);
+    add_overhead_options(options);
+    add_resctrl_options(options);
+    add_alert_options(options);
+    add_detect_options(options);
+    add_ecam_options(options);
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    if (result.count("version")){
+      std::cout << "cpu performance monitor tool\n" << "version: 0.0.1" << std::endl;
+      exit(0);
+    }
+
+    DEBUG = result["debug"].as<bool>();
+    //if (DEBUG) spdlog::set_level(spdlog::level::debug);
+    //else spdlog::set_level(spdlog::level::warn);
+    OUT_FILE=result["output"].as<string>();
+    if (OUT_FILE.size()>0){
+        SEP=",";
+        empty_output();
+        OUT.open(OUT_FILE, ios_base::app);
+    }
+    //cout<<"OUT_FILE.size()="<<OUT_FILE.size()<<endl;
+    SHOW_CHANNELS=result["channels"].as<bool>();
+    SHOW_MEMORY=result["memory"].as<bool>();
+    SHOW_PCIE=result["pcie"].as<bool>();
+    SHOW_LATENCY=result["latency"].as<bool>();
+    SHOW_UPI=result["upi"].as<bool>();
+    SHOW_ENERGY=result["energy"].as<bool>();
+    delay=result["delay"].as<float>(); //PCM_DELAY_DEFAULT
+    /////////////////////////////////////////////
+    PCM *m = PCM::getInstance();
+    PCM::ErrorCode returnResult = m->program();
+    if (returnResult != PCM::Success) {
+        std::cerr << "PCM couldn't start" << std::endl;
+        std::cerr << "Error code: " << returnResult << std::endl;
+        exit(1);
+    }
+    if (SHOW_LATENCY && m->programServerUncoreLatencyMetrics(false) != PCM::Success){
+        std::cerr << "PCM couldn't program the IMC latency events" << std::endl;
+        exit(1);
+    }
+    if (SHOW_ENERGY && !energy_setup(m))
+        SHOW_ENERGY = false;
+    SHOW_RESCTRL = resctrl_setup(result);
+    if (SHOW_PCIE) ecam_setup(result);
+    unique_ptr<IPlatform> platform;
+    if (SHOW_PCIE && !(pcie_window = pcie_window_setup(m))){
+        // no iio event layout for this cpu here, pcm-pcie sleeps its own delay
+        platform.reset(IPlatform::getPlatform(m, false, true, true, (std::max)(1u, (uint)delay)));
+        if (platform == NULL){
+            std::cout << "unsupported platform, exiting." << std::endl;
+            return -1;
+        }
+    }
+    uint32 numSockets = m->getNumSockets();
+    imc_setup(m);
+    if (OUT_FILE.size()<1)
+        cout << "Time      ";
+    else
+        append_file("Time");
+
+    vector<string> columns = mem_columns(numSockets);
+    trigger_setup(result, columns, 0);
+    alert_setup(result, columns);
+    detect_setup(result, columns);
+    const float coarse = delay;
+    run_setup(result);
+    vector<string> read_names;
+    for (uint32 i=0; i<numSockets; ++i)
+        read_names.push_back("S" + std::to_string(i));
+    overhead_setup(result, read_names);
+    for (auto c = columns.cbegin(); c != columns.cend(); ++c){
+        if (OUT_FILE.size()<1){
+            cout << SEP << *c;
+        }else{
+            append_file("," + *c);
+        }
+    }
+    if (OUT_FILE.size()<1){
+        cout << endl;
+    }else{
+        append_file("\n");
+    }
+
+    imc_state BeforeState, AfterState;  //memory
+    uint64 BeforeTime = 0, AfterTime = 0;
+    vector<double> values;
+    imc_read(BeforeState);
+    if (SHOW_UPI) BeforeState.upi = m->getSystemCounterState();
+    if (SHOW_ENERGY) energy_read(m, BeforeState.energy);
+    if (SHOW_RESCTRL) resctrl_read(BeforeState.mbm);
+    if (pcie_window) pcie_window_read(m, BeforeState.iio);
+    BeforeTime = m->getTickCount();
+    for (;;){
+        overhead_sleep(delay);
+        if (OUT_FILE.size()<1){
+            cout << currentDateTime();
+        }else{
+            append_file(currentDateTime());
+        }
+        if (platform){
+            platform->getEvents();//pcie
+            platform->printHeader();
+            platform->printEvents();
+        }
+        for (uint32 i=0; i<numSockets; ++i) {
+            const uint64 t = overhead_clock();
+            imc_read(i, AfterState);  //memory
+            overhead_add(OVERHEAD_READ + i, t);
+            // m->getPCIeCounterData(skt, ctr);
+        }
+        if (pcie_window) pcie_window_read(m, AfterState.iio);        //pcie
+        if (SHOW_UPI) AfterState.upi = m->getSystemCounterState();  //upi
+        if (SHOW_ENERGY) energy_read(m, AfterState.energy);          //rapl
+        if (SHOW_RESCTRL) resctrl_read(AfterState.mbm);              //mbm
+        AfterTime = m->getTickCount();
+        printMemBW(numSockets,BeforeState,AfterState,AfterTime-BeforeTime,values);
+        alert_check(values);
+        detect_check(values);
+        swap(BeforeTime, AfterTime);
+        swap(BeforeState, AfterState);
+        if (platform) platform->cleanup();
+        overhead_interval();
+        if (!run_continue(values)) break;
+        delay = trigger_interval(values, coarse);
+    }
+    if (OUT.is_open()) OUT.close();
+    run_summary(columns);
+    overhead_summary();
+    if (SHOW_RESCTRL) resctrl_cleanup();
+
+    //std::cout << "=====================================" << std::endl;
+    //SystemCounterState before_sstate = getSystemCounterState();
+    //SystemCounterState after_sstate = getSystemCounterState();
+
+    //std::cout << "Instructions per clock:" << getIPC(before_sstate, after_sstate) << std::endl;
+    //std::cout << "Bytes read:" << getBytesReadFromMC(before_sstate, after_sstate) << std::endl;
+    m->cleanup();
+    exit(EXIT_SUCCESS);
+}
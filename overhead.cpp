@@ -0,0 +1,155 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// What the monitor costs the box it watches. Per interval: how late the
+// sleeps woke up, ns spent in counter reads per socket/stack, in formatting
+// and in writing, and the process's own CPU time. The period of every
+// interval against the sleeps asked for goes into a jitter histogram that
+// is printed at the end of the run. Off unless --overhead is given, then
+// overhead_clock() returns 0 and the hooks do nothing.
+static bool enabled = false;
+static std::ofstream OUT;
+static vector<string> slot_names;       // OVERHEAD_FORMAT, OVERHEAD_WRITE, reads...
+static vector<uint64> slot_ns;
+static uint64 interval_start = 0;
+static uint64 late_ns = 0;
+static double pending_sleep = 0;        // seconds asked for since the last interval
+static struct rusage last_usage;
+static metric_stats jitter;             // |period - slept| in us
+static metric_stats cpu;                // % of one core
+static const double edges_us[] = {10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000};
+static const size_t nedges = sizeof(edges_us) / sizeof(edges_us[0]);
+static vector<uint64> jitter_buckets(nedges + 1, 0);
+
+static inline uint64 now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline double tv_us(const struct timeval& tv){
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+void add_overhead_options(cxxopts::Options& options){
+    options.add_options("overhead")
+        ("overhead", "Write per interval self-overhead csv here and print a jitter histogram at exit", cxxopts::value<string>()->default_value(""))
+    ;
+}
+
+// read_names[i] is the name of slot OVERHEAD_READ + i, empty ones are left out
+void overhead_setup(const cxxopts::ParseResult& result, const vector<string>& read_names){
+    const string file = result["overhead"].as<string>();
+    if (file.empty()) return;
+    OUT.open(file.c_str(), std::ios_base::out);
+    if (!OUT.is_open()){
+        cerr << "overhead: can't open " << file << endl;
+        exit(EXIT_FAILURE);
+    }
+    enabled = true;
+    slot_names.clear();
+    slot_names.push_back("format");
+    slot_names.push_back("write");
+    slot_names.insert(slot_names.end(), read_names.begin(), read_names.end());
+    slot_ns.assign(slot_names.size(), 0);
+    jitter.reset();
+    cpu.reset();
+    OUT << "Time,interval_ms,late_us";
+    for (size_t i = OVERHEAD_READ; i < slot_names.size(); i++)
+        if (slot_names[i].size()) OUT << ",read_" << slot_names[i] << "_us";
+    OUT << ",format_us,write_us,user_us,sys_us,cpu_pct\n";
+    getrusage(RUSAGE_SELF, &last_usage);
+    interval_start = now_ns();
+}
+
+uint64 overhead_clock(){
+    return enabled ? now_ns() : 0;
+}
+
+void overhead_add(int slot, uint64 since){
+    if (!enabled || slot < 0 || (size_t)slot >= slot_ns.size()) return;
+    slot_ns[slot] += now_ns() - since;
+}
+
+// MySleepMs() that remembers how late it woke up
+void overhead_sleep(double seconds){
+    if (!enabled){
+        MySleepMs(int(seconds * 1000));
+        return;
+    }
+    const uint64 deadline = now_ns() + (uint64)(int(seconds * 1000)) * 1000000ULL;
+    MySleepMs(int(seconds * 1000));
+    const uint64 woke = now_ns();
+    if (woke > deadline)
+        late_ns = (std::max)(late_ns, woke - deadline);
+    pending_sleep += int(seconds * 1000) / 1000.0;
+}
+
+// close the interval: one csv row, fold the period into the jitter histogram
+void overhead_interval(){
+    if (!enabled) return;
+    const uint64 now = now_ns();
+    const double period_us = (now - interval_start) / 1000.0;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const double user_us = tv_us(usage.ru_utime) - tv_us(last_usage.ru_utime);
+    const double sys_us = tv_us(usage.ru_stime) - tv_us(last_usage.ru_stime);
+    const double cpu_pct = period_us > 0 ? (user_us + sys_us) / period_us * 100 : 0;
+
+    char buf[64];
+    OUT << currentDateTime();
+    snprintf(buf, sizeof(buf), ",%.3f,%.1f", period_us / 1000, late_ns / 1000.0);
+    OUT << buf;
+    for (size_t i = OVERHEAD_READ; i < slot_names.size(); i++){
+        if (slot_names[i].empty()) continue;
+        snprintf(buf, sizeof(buf), ",%.1f", slot_ns[i] / 1000.0);
+        OUT << buf;
+    }
+    snprintf(buf, sizeof(buf), ",%.1f,%.1f,%.0f,%.0f,%.2f\n", slot_ns[OVERHEAD_FORMAT] / 1000.0,
+             slot_ns[OVERHEAD_WRITE] / 1000.0, user_us, sys_us, cpu_pct);
+    OUT << buf;
+    OUT.flush();
+
+    const double j = period_us > pending_sleep * 1e6 ? period_us - pending_sleep * 1e6 : pending_sleep * 1e6 - period_us;
+    jitter.add(j);
+    cpu.add(cpu_pct);
+    const size_t b = std::upper_bound(edges_us, edges_us + nedges, j) - edges_us;
+    jitter_buckets[b]++;
+
+    std::fill(slot_ns.begin(), slot_ns.end(), 0);
+    late_ns = 0;
+    pending_sleep = 0;
+    last_usage = usage;
+    interval_start = now;
+}
+
+void overhead_summary(){
+    if (!enabled) return;
+    OUT.close();
+    char buf[128];
+    snprintf(buf, sizeof(buf), "jitter: %llu intervals, p50 %.0f us, p99 %.0f us, max %.0f us; cpu mean %.2f%% max %.2f%%",
+             (unsigned long long)jitter.n, jitter.percentile(0.50), jitter.percentile(0.99), jitter.max, cpu.mean, cpu.max);
+    cerr << buf << endl;
+    if (jitter.n == 0) return;
+    for (size_t b = 0; b <= nedges; b++){
+        if (jitter_buckets[b] == 0) continue;
+        if (b < nedges)
+            snprintf(buf, sizeof(buf), "    < %6.0f us %8llu  %5.1f%%", edges_us[b], (unsigned long long)jitter_buckets[b], 100.0 * jitter_buckets[b] / jitter.n);
+        else
+            snprintf(buf, sizeof(buf), "   >= %6.0f us %8llu  %5.1f%%", edges_us[nedges - 1], (unsigned long long)jitter_buckets[b], 100.0 * jitter_buckets[b] / jitter.n);
+        cerr << buf << endl;
+    }
+}
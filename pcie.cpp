@@ -8,18 +8,17 @@
 #include <cstdint>
 #include <numeric>
 #include <algorithm>
+#include <cmath>
 #include "lspci.h"
 #include "utils.h"
 #include "cxxopts.hpp"
+#include "pmt.h"
 using namespace std;
 using namespace pcm;
 
 string csv_delimiter = ",";
-std::ostream* OUT = &std::cout;
-string OUT_FILE="";
+static std::ostream* OUT = &std::cout;
 vector<string> ONLY;
-float delay=1.0;
-bool DEBUG=false;
 const uint8_t max_sockets = 4;
 static const std::string iio_stack_names[6] = {
     "IIO Stack 0 - CBDMA/DMI      ",
@@ -72,30 +71,61 @@ static const std::map<int, int> icx_d_sad_to_pmu_id_mapping = {
 };
 
 map<string,PCM::PerfmonField> opcodeFieldMap;
-map<string,std::pair<h_id,std::map<string,v_id>>> nameMap;
-result_content results(max_sockets, stack_content(6, ctr_data()));
+vector<struct counter> counters;
+std::vector<struct iio_stacks_on_socket> iios;
+PCIDB pciDB;
+const uint32_t max_stacks = 6;
+// event names are interned once when the events are loaded: a counter's
+// h_id/v_id index h_names/v_names, and the rates of the last interval are a
+// dense [h][v][socket][stack] matrix the output walks in id order. A row is
+// laid out like a counter's iio_raw row, so it is one rate_scale_u64() pass
+static vector<string> h_names, v_names;
+static vector<uint64_t> rates;
+static vector<string> csv_extra_header;     // per socket columns appended to every build_csv row
+static vector<vector<double>> csv_extra;    // [socket]
+vector<uint64_t> iio_raw;       // [counter][socket][stack] deltas of the last collect_data
+uint32_t iio_slice_ms = 0;
 
 struct data{
     uint32_t width;
     uint64_t value;
 };
 
-void print_nameMap() {
-    for (std::map<string,std::pair<h_id,std::map<string,v_id>>>::const_iterator iunit = nameMap.begin(); iunit != nameMap.end(); ++iunit)
-    {
-        string h_name = iunit->first;
-        std::pair<h_id,std::map<string,v_id>> value = iunit->second;
-        uint32_t hid = value.first;
-        std::map<string,v_id> vMap = value.second;
-        cout << "H name: " << h_name << " id =" << hid << " vMap size:" << vMap.size() << "\n";
-        for (std::map<string,v_id>::const_iterator junit = vMap.begin(); junit != vMap.end(); ++junit)
-        {
-            string v_name = junit->first;
-            uint32_t vid = junit->second;
-            cout << "V name: " << v_name << " id =" << vid << "\n";
+static uint32_t intern(vector<string>& names, const string& name){
+    auto it = std::find(names.begin(), names.end(), name);
+    if (it != names.end()) return (uint32_t)(it - names.begin());
+    names.push_back(name);
+    return (uint32_t)names.size() - 1;
+}
 
-        }
-    }
+// the four bandwidth directions are h ids 0..3
+static uint32_t h_shown(){
+    return (std::min)((uint32_t)h_names.size(), 4u);
+}
+
+static const size_t row_len = max_sockets * max_stacks;
+
+// [socket * max_stacks + stack] of one event
+static uint64_t* rate_row(uint32_t h, uint32_t v){
+    return &rates[(h * v_names.size() + v) * row_len];
+}
+
+// bytes/s from a counter's raw counts over delay_ms, iio_rate() of a whole row
+static void rate_counter(const struct counter& ctr, const uint64_t* raw, uint32_t delay_ms){
+    rate_scale_u64(raw, rate_row(ctr.h_id, ctr.v_id), row_len, ctr.multiplier / (double) ctr.divider * (1000 / (double) delay_ms));
+}
+
+// the matrix for the names loaded so far, kept across intervals
+static void size_rates(){
+    const size_t n = row_len * h_names.size() * v_names.size();
+    if (rates.size() != n) rates.assign(n, 0);
+}
+
+void print_event_names() {
+    for (uint32_t h = 0; h < h_names.size(); h++)
+        cout << "H name: " << h_names[h] << " id =" << h << "\n";
+    for (uint32_t v = 0; v < v_names.size(); v++)
+        cout << "V name: " << v_names[v] << " id =" << v << "\n";
 }
 
 string a_title (const string &init, const string &name) {
@@ -129,21 +159,11 @@ string a_header_footer (string init, string name){
     return build_line(init, name);
 }
 
+// headers in h id order, the order the data columns are in
 vector<string> combine_stack_name_and_counter_names(string stack_name){
     vector<string> v;
-    vector<string> tmp(nameMap.size());
     v.push_back(stack_name);
-    for (std::map<string,std::pair<h_id,std::map<string,v_id>>>::const_iterator iunit = nameMap.begin(); iunit != nameMap.end(); ++iunit) {
-        string h_name = iunit->first;
-        int h_id = (iunit->second).first;
-        if (h_id<4) //tmp[h_id] = h_name;
-            v.push_back(h_name);
-        //cout << "h_id:" << h_id << " name:" << h_name << "\n";
-    }
-    //XXX: How to simplify and just combine tmp & v?
-    //for (uint32_t i = 0; i < nameMap.size(); i++) {
-    //    v.push_back(tmp[i]);
-    //}
+    v.insert(v.end(), h_names.begin(), h_names.begin() + h_shown());
     return v;
 }
 
@@ -195,12 +215,13 @@ string build_pci_header(const PCIDB & pciDB, uint32_t column_width, struct pci p
     return s;
 }
 
-vector<string> build_display(vector<struct iio_stacks_on_socket>& iios, vector<struct counter>& ctrs, const PCIDB& pciDB){
+vector<string> build_display(const vector<struct iio_stacks_on_socket>& iios, const PCIDB& pciDB){
     vector<string> buffer;
     vector<string> headers;
     vector<struct data> data;
     uint64_t header_width;
     string row;
+    size_rates();
     for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
         buffer.push_back("Socket" + std::to_string(socket->socket_id));
         for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
@@ -216,24 +237,14 @@ vector<string> build_display(vector<struct iio_stacks_on_socket>& iios, vector<s
             //Print deliminator
             row = std::accumulate(headers.begin(), headers.end(), string("|"), a_header_footer);
             buffer.push_back(row);
-            //Print data
-            std::map<uint32_t,map<uint32_t,struct counter*>> v_sort;
-            //re-organize data collection to be row wise
-            for (std::vector<struct counter>::iterator counter = ctrs.begin(); counter != ctrs.end(); ++counter) {
-                v_sort[counter->v_id][counter->h_id] = &(*counter);
-            }
-            for (std::map<uint32_t,map<uint32_t,struct counter*>>::const_iterator vunit = v_sort.cbegin(); vunit != v_sort.cend(); ++vunit) {
-                map<uint32_t, struct counter*> h_array = vunit->second;
-                uint32_t vv_id = vunit->first;
-                vector<uint64_t> h_data;
-                string v_name = h_array[0]->v_event_name;
-                for (map<uint32_t,struct counter*>::const_iterator hunit = h_array.cbegin(); hunit != h_array.cend(); ++hunit) {
-                    uint32_t hh_id = hunit->first;
-                    uint64_t raw_data = hunit->second->data[0][socket->socket_id][stack_id][std::pair<h_id,v_id>(hh_id,vv_id)];
-                    h_data.push_back(raw_data);
-                }
+            //Print data, a row per v id
+            const uint32_t idx = socket->socket_id * max_stacks + stack_id;
+            vector<uint64_t> h_data(h_shown());
+            for (uint32_t v = 0; v < v_names.size(); v++) {
+                for (uint32_t h = 0; h < h_data.size(); h++)
+                    h_data[h] = rate_row(h, v)[idx];
                 data = prepare_data(h_data, headers);
-                row = "| " + v_name;
+                row = "| " + v_names[v];
                 row += string(headers[0].size() - (row.size() - 1), ' ');
                 row += std::accumulate(data.begin(), data.end(), string("|"), a_data);
                 buffer.push_back(row);
@@ -287,6 +298,45 @@ std::string get_bus_no(const struct pci p){
     rp_pci.append(tmp);
     return rp_pci;
 }
+// the device a stack is reported under, same selection build_csv makes
+string stack_bus_no(const struct iio_stack& stack){
+    string bus_no;
+    for (const auto& part : stack.parts) {
+        for (const auto& pci_device : part.child_pci_devs) {
+            bus_no = get_bus_no(pci_device);
+        }
+    }
+    if (ONLY.size() <1){}
+    else if (!std::count(ONLY.begin(), ONLY.end(), bus_no)) {
+        return "";
+    }
+    return bus_no;
+}
+
+// the stacks reported under a device, in output order, found once per
+// topology instead of formatting every device's bus number each interval
+struct shown_stack{
+    uint32_t socket, stack;
+    string bus_no;
+};
+static vector<shown_stack> shown;
+static bool shown_valid = false;
+static bool parts_valid = false;    // part_rows() of the live view
+
+static const vector<shown_stack>& shown_stacks(){
+    if (!shown_valid){
+        shown.clear();
+        for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
+            for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
+                shown_stack s = {socket->socket_id, stack->iio_unit_id, stack_bus_no(*stack)};
+                if (s.bus_no.size()) shown.push_back(s);
+            }
+        }
+        shown_valid = true;
+    }
+    return shown;
+}
+
 template <typename T>
 std::string to_string_with_precision(const T a_value, const int n = 6)
 {
@@ -295,82 +345,34 @@ std::string to_string_with_precision(const T a_value, const int n = 6)
     out << std::fixed << a_value;
     return out.str();
 }
-vector<string> build_csv(vector<struct iio_stacks_on_socket>& iios, vector<struct counter>& ctrs, const PCIDB& pciDB){
+// a row per shown_stacks() entry, from the rate matrix
+vector<string> build_csv(){
     vector<string> result;
     vector<string> current_row;
     auto header = combine_stack_name_and_counter_names("Bus");
     //header.insert(header.begin(), "Name");
     //header.insert(header.begin(), "BusNo");
     header.insert(header.begin(), "Socket");
+    header.insert(header.end(), csv_extra_header.begin(), csv_extra_header.end());
     result.push_back(build_csv_row(header, csv_delimiter));
-    std::map<uint32_t,map<uint32_t,struct counter*>> v_sort;
-    //re-organize data collection to be row wise
-    size_t max_name_width = 0;
-    for (std::vector<struct counter>::iterator counter = ctrs.begin(); counter != ctrs.end(); ++counter) {
-        v_sort[counter->v_id][counter->h_id] = &(*counter);
-        max_name_width = (std::max)(max_name_width, counter->v_event_name.size());
-    }
+    size_rates();
 
-    for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
-        for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
-            const std::string socket_name = "Socket" + std::to_string(socket->socket_id);
-            string bus_no;
-            for (const auto& part : stack->parts) {
-                for (const auto& pci_device : part.child_pci_devs) {
-                    bus_no = get_bus_no(pci_device);
-                    //cout<<"   bus_no="<<bus_no<<endl;
-                }
-            }
-            if (ONLY.size() <1){}
-            else if (!std::count(ONLY.begin(), ONLY.end(), bus_no)) {
-                continue;
-            }
-            if (bus_no.size() <1) continue;
-            std::string stack_name = stack->stack_name;
-            stack_name.erase(stack_name.find_last_not_of(' ') + 1);
-            const uint32_t stack_id = stack->iio_unit_id;
-                current_row.clear();
-                current_row.push_back(socket_name);
-                current_row.push_back(bus_no);
-                uint64_t IW=0,IR=0,OR=0,OW=0;
-            //cout<<"v_sort.size()="<<v_sort.size()<<endl;
-            //std::map<uint32_t,map<uint32_t,struct counter*>>::const_iterator vunit;
-            for (auto vunit = v_sort.cbegin(); vunit != v_sort.cend(); ++vunit ) {
-                map<uint32_t, struct counter*> h_array = vunit->second;
-                uint32_t vv_id = vunit->first;
-                vector<uint64_t> h_data;
-                //string v_name = h_array[0]->v_event_name;
-                //current_row.clear();
-                //current_row.push_back(socket_name);
-                //current_row.push_back(bus_no);
-                //current_row.push_back(stack_name);
-                //current_row.push_back(v_name);
-                //cout<<"   bus_no="<<bus_no<<endl;
-                
-                for (map<uint32_t,struct counter*>::const_iterator hunit = h_array.cbegin(); hunit != h_array.cend(); ++hunit) {
-                    uint32_t hh_id = hunit->first;
-                    //cout<<"vv_id="<<vv_id<<"    hh_id="<<hh_id<<endl;
-                    uint64_t raw_data = hunit->second->data[0][socket->socket_id][stack_id][std::pair<h_id,v_id>(hh_id,vv_id)];
-                    if(hh_id<1){
-                        IW+=raw_data;
-                    }else if(hh_id<2){
-                        IR+=raw_data;
-                    }else if(hh_id<3){
-                        OR+=raw_data;
-                    }else if(hh_id<4){
-                        OW+=raw_data;
-                    }
-                    //current_row.push_back(std::to_string(raw_data));  // unit_format(raw_data)
-                }
-                //result.push_back(build_csv_row(current_row, csv_delimiter));
-            }
-            current_row.push_back(to_string_with_precision(IW/1000000,2));
-            current_row.push_back(to_string_with_precision(IR/1000000,2));
-            current_row.push_back(to_string_with_precision(OR/1000000,2));
-            current_row.push_back(to_string_with_precision(OW/1000000,2));
-            result.push_back(build_csv_row(current_row, csv_delimiter));
-            //cout<<"loop end"<<endl;
+    for (auto st = shown_stacks().cbegin(); st != shown_stacks().cend(); ++st) {
+        current_row.clear();
+        current_row.push_back("Socket" + std::to_string(st->socket));
+        current_row.push_back(st->bus_no);
+        // IW, IR, OR, OW: each direction summed over its v row
+        const uint32_t idx = st->socket * max_stacks + st->stack;
+        for (uint32_t h = 0; h < h_shown(); h++) {
+            uint64_t sum = 0;
+            for (uint32_t v = 0; v < v_names.size(); v++)
+                sum += rate_row(h, v)[idx];
+            current_row.push_back(to_string_with_precision(sum/1000000,2));
         }
+        if (st->socket < csv_extra.size())
+            for (auto v = csv_extra[st->socket].cbegin(); v != csv_extra[st->socket].cend(); ++v)
+                current_row.push_back(to_string_with_precision(*v,2));
+        result.push_back(build_csv_row(current_row, csv_delimiter));
     }
     return result;
 }
@@ -381,6 +383,50 @@ void display(const vector<string> &buff, std::ostream& stream){
     stream << std::flush;
 }
 
+// probe_pci() from loads of the mapped ECAM window (ecam.cpp): ids, header
+// type, bridge bus numbers and the link status of the PCIe capability
+static bool ecam_probe(struct pci* p){
+    const uint32 b = p->bdf.busno, d = p->bdf.devno, f = p->bdf.funcno;
+    const uint32 id = ecam_read32(b, d, f, 0x0);
+    p->exist = false;
+    if ((id & 0xffff) == 0xffff) return false;
+    p->vendor_id = id & 0xffff;
+    p->device_id = id >> 16;
+    p->header_type = (ecam_read32(b, d, f, 0xc) >> 16) & 0x7f;
+    if (p->header_type == 1){
+        const uint32 buses = ecam_read32(b, d, f, 0x18);
+        p->secondary_bus_number = (buses >> 8) & 0xff;
+        p->subordinate_bus_number = (buses >> 16) & 0xff;
+    }
+    if (ecam_read32(b, d, f, 0x4) & 0x100000){           // capabilities list
+        uint32 cap = ecam_read32(b, d, f, 0x34) & 0xfc;
+        for (int n = 0; cap && n < 48; n++){
+            const uint32 hdr = ecam_read32(b, d, f, cap);
+            if ((hdr & 0xff) == 0x10){                  // PCI Express
+                const uint32 sta = ecam_read32(b, d, f, cap + 0x10) >> 16;
+                p->link_speed = sta & 0xf;
+                p->link_width = (sta >> 4) & 0x3f;
+                break;
+            }
+            cap = (hdr >> 8) & 0xfc;
+        }
+    }
+    p->exist = true;
+    return true;
+}
+
+static bool probe(struct pci* p){
+    return ecam_active() ? ecam_probe(p) : probe_pci(p);
+}
+
+// with ECAM mapped a probe is a load; otherwise probe_pci() only where the
+// batched scan in pciscan.cpp didn't rule the function out
+static bool probe_present(struct pci* p){
+    if (ecam_active()) return ecam_probe(p);
+    if (!pci_maybe_present(p->bdf.busno, p->bdf.devno, p->bdf.funcno)) return false;
+    return probe_pci(p);
+}
+
 class IPlatformMapping {
 private:
 public:
@@ -403,12 +449,16 @@ bool IPlatformMapping10Nm::getSadIdRootBusMap(uint32_t socket_id, std::map<uint8
                 pci_dev.bdf.busno = (uint8_t)bus;
                 pci_dev.bdf.devno = device;
                 pci_dev.bdf.funcno = function;
-                if (probe_pci(&pci_dev) && (pci_dev.vendor_id == PCM_INTEL_PCI_VENDOR_ID)
+                if (probe_present(&pci_dev) && (pci_dev.vendor_id == PCM_INTEL_PCI_VENDOR_ID)
                     && (pci_dev.device_id == SNR_ICX_MESH2IIO_MMAP_DID)) {
 
-                    PciHandleType h(0, bus, device, function);
                     std::uint32_t sad_ctrl_cfg;
-                    h.read32(SNR_ICX_SAD_CONTROL_CFG_OFFSET, &sad_ctrl_cfg);
+                    if (ecam_active()){
+                        sad_ctrl_cfg = ecam_read32(bus, device, function, SNR_ICX_SAD_CONTROL_CFG_OFFSET);
+                    }else{
+                        PciHandleType h(0, bus, device, function);
+                        h.read32(SNR_ICX_SAD_CONTROL_CFG_OFFSET, &sad_ctrl_cfg);
+                    }
                     if (sad_ctrl_cfg == (std::numeric_limits<uint32_t>::max)()) {
                         cerr << "Could not read SAD_CONTROL_CFG" << endl;
                         return false;
@@ -484,7 +534,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                     bdf->busno = root_bus;
                     bdf->devno = 0x00;
                     bdf->funcno = 0x00;
-                    probe_pci(pci);
+                    probe(pci);
                     // Probe child devices only under PCH part.
                     for (uint8_t bus = pci->secondary_bus_number; bus <= pci->subordinate_bus_number; bus++) {
                         for (uint8_t device = 0; device < 32; device++) {
@@ -493,7 +543,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                                 child_pci_dev.bdf.busno = bus;
                                 child_pci_dev.bdf.devno = device;
                                 child_pci_dev.bdf.funcno = function;
-                                if (probe_pci(&child_pci_dev)) {
+                                if (probe_present(&child_pci_dev)) {
                                     pch_part.child_pci_devs.push_back(child_pci_dev);
                                 }
                             }
@@ -509,7 +559,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                 bdf->busno = root_bus;
                 bdf->devno = 0x01;
                 bdf->funcno = 0x00;
-                probe_pci(pci);
+                probe(pci);
                 stack.parts.push_back(part);
 
                 iio_on_socket.stacks.push_back(stack);
@@ -523,7 +573,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                 pci.bdf.busno = root_bus;
                 pci.bdf.devno = slot;
                 pci.bdf.funcno = 0x00;
-                if (!probe_pci(&pci)) {
+                if (!probe(&pci)) {
                     continue;
                 }
                 struct iio_bifurcated_part part;
@@ -537,7 +587,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                             child_pci_dev.bdf.busno = bus;
                             child_pci_dev.bdf.devno = device;
                             child_pci_dev.bdf.funcno = function;
-                            if (probe_pci(&child_pci_dev)) {
+                            if (probe_present(&child_pci_dev)) {
                                 part.child_pci_devs.push_back(child_pci_dev);
                             }
                         }
@@ -586,10 +636,10 @@ ccr* get_ccr(PCM* m, uint64_t& ccr){
     }
 }
 
-vector<struct counter> load_events(PCM * m, const char* fn){
+// parse fn with pccr's control register layout, ctr.ccr is its value per line
+vector<struct counter> load_events(ccr& pccr, const char* fn){
     vector<struct counter> v;
     struct counter ctr{};
-    std::unique_ptr<ccr> pccr(get_ccr(m, ctr.ccr));
 
     std::ifstream in(fn);
     std::string line, item;
@@ -606,7 +656,7 @@ vector<struct counter> load_events(PCM * m, const char* fn){
     while (std::getline(in, line)) {
         /* Ignore anyline with # */
         //TODO: substring until #, if len == 0, skip, else parse normally
-        pccr->set_ccr_value(0);
+        pccr.set_ccr_value(0);
         if (line.find("#") != std::string::npos)
             continue;
         /* If line does not have any deliminator, we ignore it as well */
@@ -628,67 +678,49 @@ vector<struct counter> load_events(PCM * m, const char* fn){
                 case PCM::H_EVENT_NAME:
                     h_name = dos2unix(value);
                     ctr.h_event_name = h_name;
-                    if (nameMap.find(h_name) == nameMap.end()) {
-                        /* It's a new horizontal event name */
-                        uint32_t next_h_id = (uint32_t)nameMap.size();
-                        std::pair<h_id,std::map<string,v_id>> nameMap_value(next_h_id, std::map<string,v_id>());
-                        nameMap[h_name] = nameMap_value;
-                    }
-                    ctr.h_id = (uint32_t)nameMap.size() - 1;
+                    ctr.h_id = intern(h_names, h_name);
                     break;
                 case PCM::V_EVENT_NAME:
-                    {
-                        v_name = dos2unix(value);
-                        ctr.v_event_name = v_name;
-                        //XXX: If h_name comes after v_name, we'll have a problem.
-                        //XXX: It's very weird, I forgot to assign nameMap[h_name] = nameMap_value earlier (:298), but this part still works?
-                        std::map<string,v_id> &v_nameMap = nameMap[h_name].second;
-                        if (v_nameMap.find(v_name) == v_nameMap.end()) {
-                            v_nameMap[v_name] = (unsigned int)v_nameMap.size() - 1;
-                        } else {
-                            cerr << "Detect duplicated v_name:" << v_name << "\n";
-                            in.close();
-                            exit(EXIT_FAILURE);
-                        }
-                        ctr.v_id = (uint32_t)v_nameMap.size() - 1;
-                        break;
-                    }
+                    v_name = dos2unix(value);
+                    ctr.v_event_name = v_name;
+                    ctr.v_id = intern(v_names, v_name);
+                    break;
                 case PCM::COUNTER_INDEX:
                     ctr.idx = (int)numValue;
                     break;
                 case PCM::OPCODE:
                     break;
                 case PCM::EVENT_SELECT:
-                    pccr->set_event_select(numValue);
+                    pccr.set_event_select(numValue);
                     break;
                 case PCM::UMASK:
-                    pccr->set_umask(numValue);
+                    pccr.set_umask(numValue);
                     break;
                 case PCM::RESET:
-                    pccr->set_reset(numValue);
+                    pccr.set_reset(numValue);
                     break;
                 case PCM::EDGE_DET:
-                    pccr->set_edge(numValue);
+                    pccr.set_edge(numValue);
                     break;
                 case PCM::IGNORED:
 		    break;
                 case PCM::OVERFLOW_ENABLE:
-                    pccr->set_ov_en(numValue);
+                    pccr.set_ov_en(numValue);
                     break;
                 case PCM::ENABLE:
-                    pccr->set_enable(numValue);
+                    pccr.set_enable(numValue);
                     break;
                 case PCM::INVERT:
-                    pccr->set_invert(numValue);
+                    pccr.set_invert(numValue);
                     break;
                 case PCM::THRESH:
-                    pccr->set_thresh(numValue);
+                    pccr.set_thresh(numValue);
                     break;
                 case PCM::CH_MASK:
-                    pccr->set_ch_mask(numValue);
+                    pccr.set_ch_mask(numValue);
                     break;
                 case PCM::FC_MASK:
-                    pccr->set_fc_mask(numValue);
+                    pccr.set_fc_mask(numValue);
                     break;
                 //TODO: double type for multiplier. drop divider variable
                 case PCM::MULTIPLIER:
@@ -704,6 +736,14 @@ vector<struct counter> load_events(PCM * m, const char* fn){
                     break;
             }
         }
+        ctr.ccr = pccr.get_ccr_value();
+        for (auto c = v.cbegin(); c != v.cend(); ++c) {
+            if (c->h_id == ctr.h_id && c->v_id == ctr.v_id) {
+                cerr << "Detect duplicated v_name:" << ctr.v_event_name << "\n";
+                in.close();
+                exit(EXIT_FAILURE);
+            }
+        }
         v.push_back(ctr);
         //cout << "Finish parsing: " << line << " size:" << v.size() << "\n";
         cout << line << " " << std::hex << ctr.ccr << std::dec << "\n";
@@ -715,10 +755,20 @@ vector<struct counter> load_events(PCM * m, const char* fn){
     return v;
 }
 
-result_content get_IIO_Samples(PCM *m, const std::vector<struct iio_stacks_on_socket>& iios, struct counter ctr, uint32_t delay_ms){
+vector<struct counter> load_events(PCM * m, const char* fn){
+    uint64_t value = 0;
+    std::unique_ptr<ccr> pccr(get_ccr(m, value));
+    return load_events(*pccr, fn);
+}
+
+// replaces the sleep of every event slice, see pcie_wait_hook()
+static void (*slice_wait)(double seconds) = NULL;
+
+void get_IIO_Samples(PCM *m, const std::vector<struct iio_stacks_on_socket>& iios, const struct counter& ctr, uint32_t delay_ms, uint64_t* raw){
     IIOCounterState *before, *after;
     uint64 rawEvents[4] = {0};
-    std::unique_ptr<ccr> pccr(get_ccr(m, ctr.ccr));
+    uint64_t ccr_value = ctr.ccr;
+    std::unique_ptr<ccr> pccr(get_ccr(m, ccr_value));
     rawEvents[ctr.idx] = pccr->get_ccr_value();
     const int stacks_count = (int)m->getMaxNumOfIIOStacks();
     before = new IIOCounterState[iios.size() * stacks_count];
@@ -729,31 +779,40 @@ result_content get_IIO_Samples(PCM *m, const std::vector<struct iio_stacks_on_so
         for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
             auto iio_unit_id = stack->iio_unit_id;
             uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
+            const uint64 t = overhead_clock();
             before[idx] = m->getIIOCounterState(socket->socket_id, iio_unit_id, ctr.idx);
+            overhead_add(OVERHEAD_READ + socket->socket_id * max_stacks + iio_unit_id, t);
         }
     }
-    MySleepMs(delay_ms);
+    if (slice_wait)
+        slice_wait(delay_ms / 1000.0);
+    else
+        overhead_sleep(delay_ms / 1000.0);
     for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
         for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
             auto iio_unit_id = stack->iio_unit_id;
             uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
+            const uint64 t = overhead_clock();
             after[idx] = m->getIIOCounterState(socket->socket_id, iio_unit_id, ctr.idx);
+            overhead_add(OVERHEAD_READ + socket->socket_id * max_stacks + iio_unit_id, t);
             uint64_t raw_result = getNumberOfEvents(before[idx], after[idx]);
-            uint64_t trans_result = uint64_t (raw_result * ctr.multiplier / (double) ctr.divider * (1000 / (double) delay_ms));
-            results[socket->socket_id][iio_unit_id][std::pair<h_id,v_id>(ctr.h_id,ctr.v_id)] = trans_result;
+            raw[socket->socket_id * max_stacks + iio_unit_id] = raw_result;
         }
     }
+    rate_counter(ctr, raw, delay_ms);
     delete[] before;
     delete[] after;
-    return results;
 }
 
 void collect_data(PCM *m, const double delay, vector<struct iio_stacks_on_socket>& iios, vector<struct counter>& ctrs){
-    const uint32_t delay_ms = uint32_t(delay * 1000 / ctrs.size());
+    // rate_counter() divides by the slice: never less than 1 ms, see pcie_min_delay()
+    const uint32_t delay_ms = (std::max)(1u, ctrs.empty() ? 0u : uint32_t(delay * 1000 / ctrs.size()));
+    iio_raw.assign(ctrs.size() * max_sockets * max_stacks, 0);
+    iio_slice_ms = delay_ms;
+    size_rates();
     for (auto counter = ctrs.begin(); counter != ctrs.end(); ++counter) {
-        counter->data.clear();
-        result_content sample = get_IIO_Samples(m, iios, *counter, delay_ms);
-        counter->data.push_back(sample);
+        uint64_t* raw = &iio_raw[(counter - ctrs.begin()) * max_sockets * max_stacks];
+        get_IIO_Samples(m, iios, *counter, delay_ms, raw);
     }
 }
 
@@ -787,10 +846,409 @@ void split_only(string ids){
     while (getline(ss, str, ',')) {
         ONLY.push_back(str);
     }
+    shown_valid = false;
+    parts_valid = false;
     cout<<"ONLY="<<ONLY.size()<<endl;
 }
 
-int main(int argc, char** argv) {
+static void init_opcode_fields(){
+    opcodeFieldMap["opcode"] = PCM::OPCODE;
+    opcodeFieldMap["ev_sel"] = PCM::EVENT_SELECT;
+    opcodeFieldMap["umask"] = PCM::UMASK;
+    opcodeFieldMap["reset"] = PCM::RESET;
+    opcodeFieldMap["edge_det"] = PCM::EDGE_DET;
+    opcodeFieldMap["ignored"] = PCM::IGNORED;
+    opcodeFieldMap["overflow_enable"] = PCM::OVERFLOW_ENABLE;
+    opcodeFieldMap["en"] = PCM::ENABLE;
+    opcodeFieldMap["invert"] = PCM::INVERT;
+    opcodeFieldMap["thresh"] = PCM::THRESH;
+    opcodeFieldMap["ch_mask"] = PCM::CH_MASK;
+    opcodeFieldMap["fc_mask"] = PCM::FC_MASK;
+    opcodeFieldMap["hname"] =PCM::H_EVENT_NAME;
+    opcodeFieldMap["vname"] =PCM::V_EVENT_NAME;
+    opcodeFieldMap["multiplier"] = PCM::MULTIPLIER;
+    opcodeFieldMap["divider"] = PCM::DIVIDER;
+    opcodeFieldMap["ctr"] = PCM::COUNTER_INDEX;
+}
+
+static void discover(PCM *m){
+    auto mapping = IPlatformMapping::getPlatformMapping(m->getCPUModel());
+    if (!mapping) {
+        cerr << "Failed to discover pci tree: unknown platform" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (!mapping->pciTreeDiscover(iios, m->getNumSockets())) {
+        exit(EXIT_FAILURE);
+    }
+    shown_valid = false;
+    parts_valid = false;
+}
+
+void pcie_setup(PCM *m){
+    load_PCIDB(pciDB);
+    string ev_file_name;
+    if (m->IIOEventsAvailable()){
+        ev_file_name = "opCode-" + std::to_string(m->getCPUModel()) + ".txt";
+    }else{
+        cerr << "This CPU is not supported by PCM IIO tool! Program aborted\n";
+        exit(EXIT_FAILURE);
+    }
+    init_opcode_fields();
+
+    counters = load_events(m, ev_file_name.c_str());
+    discover(m);
+}
+
+void pcie_collect(PCM *m, const double delay){
+    collect_data(m, delay, iios, counters);
+}
+
+// fn(seconds) waits out each event slice instead of a plain sleep, so a
+// caller can serve its sockets while pcie_collect() runs
+void pcie_wait_hook(void (*fn)(double seconds)){
+    slice_wait = fn;
+}
+
+// shortest interval collect_data() can slice, 1 ms per event
+float pcie_min_delay(){
+    return counters.size() / 1000.0f;
+}
+
+// mem -p: one whole-stack event per direction, in pcie_columns() order,
+// programmed once. The counters then run through the whole interval and are
+// read at the same two points as the IMC instead of the time-sliced pass of
+// collect_data(). Each event is the opCode-<model>.txt encoding of that
+// direction (h id 0..3) with the ch_masks of all its parts OR-ed, so mem -p
+// counts what pcie counts, summed over the parts. It goes on the counter the
+// file names (ctr=), IIO events only count on some of the four.
+static double window_bytes = 4;     // multiplier / divider of the four events
+static int window_ctr[4] = {0, 1, 2, 3};    // counter of each direction
+
+// false where get_ccr() doesn't know the control register layout or the
+// event file has no single encoding and counter per direction: mem -p then
+// goes through pcm
+bool pcie_window_setup(PCM *m){
+    if (m->getCPUModel() != PCM::ICX && m->getCPUModel() != PCM::SNOWRIDGE) return false;
+    if (!m->IIOEventsAvailable()) return false;
+    try{
+        pcie_setup(m);
+    }catch (const std::invalid_argument& e){
+        cerr << "pcie window: " << e.what() << endl;
+        return false;
+    }
+    // the ch_mask bits of this cpu's control register
+    uint64_t ch_bits = 0;
+    {
+        std::unique_ptr<ccr> pccr(get_ccr(m, ch_bits));
+        pccr->set_ch_mask(0xfff);
+    }
+    uint64 rawEvents[4] = {0};
+    bool used[4] = {false, false, false, false};
+    for (uint32_t h = 0; h < 4; h++){
+        bool found = false;
+        uint64 event = 0;
+        for (auto c = counters.cbegin(); c != counters.cend(); ++c){
+            if (c->h_id != h) continue;
+            const double bytes = c->multiplier / (double)c->divider;
+            if (!found && h == 0) window_bytes = bytes;
+            if ((found && (c->ccr & ~ch_bits) != (event & ~ch_bits)) || bytes != window_bytes){
+                cerr << "pcie window: " << c->h_event_name << " differs between parts, mem -p falls back to pcm" << endl;
+                return false;
+            }
+            if (c->idx < 0 || c->idx > 3 || (found && c->idx != window_ctr[h]) || (!found && used[c->idx])){
+                cerr << "pcie window: " << c->h_event_name << " has no counter of its own, mem -p falls back to pcm" << endl;
+                return false;
+            }
+            window_ctr[h] = c->idx;
+            event = found ? event | (c->ccr & ch_bits) : c->ccr;
+            found = true;
+        }
+        if (!found){
+            cerr << "pcie window: no event with h id " << h << ", mem -p falls back to pcm" << endl;
+            return false;
+        }
+        used[window_ctr[h]] = true;
+        rawEvents[window_ctr[h]] = event;
+    }
+    m->programIIOCounters(rawEvents);
+    return true;
+}
+
+// [(socket * max_stacks + iio_unit_id) * 4 + counter], stacks pcie_columns() shows
+void pcie_window_read(PCM *m, vector<IIOCounterState>& states){
+    states.resize(max_sockets * max_stacks * 4);
+    for (auto st = shown_stacks().cbegin(); st != shown_stacks().cend(); ++st)
+        m->getIIOCounterStates(st->socket, st->stack, &states[(st->socket * max_stacks + st->stack) * 4]);
+}
+
+// MB/s in pcie_columns() order over the window of two pcie_window_read()
+void pcie_window_values(const vector<IIOCounterState>& before, const vector<IIOCounterState>& after, const uint64 elapsedTime, vector<double>& values){
+    static vector<uint64> events;
+    events.clear();
+    for (auto st = shown_stacks().cbegin(); st != shown_stacks().cend(); ++st) {
+        const size_t base = (st->socket * max_stacks + st->stack) * 4;
+        for (int h = 0; h < 4; h++){
+            const size_t i = base + window_ctr[h];
+            events.push_back(i < before.size() && i < after.size() ? getNumberOfEvents(before[i], after[i]) : 0);
+        }
+    }
+    const size_t at = values.size();
+    values.resize(at + events.size());
+    rate_scale(events.data(), values.data() + at, events.size(), elapsedTime ? window_bytes / 1000000.0 / (elapsedTime / 1000.0) : 0);
+}
+
+vector<string> pcie_columns(){
+    static const char* dirs[4] = {"IBW", "IBR", "OBR", "OBW"};
+    vector<string> columns;
+    for (auto st = shown_stacks().cbegin(); st != shown_stacks().cend(); ++st)
+        for (int h = 0; h < 4; h++)
+            columns.push_back("S" + std::to_string(st->socket) + "_" + st->bus_no + "_" + dirs[h]);
+    return columns;
+}
+
+// MB/s per device in pcie_columns() order
+void pcie_values(vector<double>& values){
+    static vector<uint64> bw;
+    const vector<shown_stack>& st = shown_stacks();
+    bw.assign(st.size() * 4, 0);
+    if (rates.size()) {
+        for (uint32_t h = 0; h < h_shown(); h++) {
+            for (uint32_t v = 0; v < v_names.size(); v++) {
+                const uint64_t* r = rate_row(h, v);
+                for (size_t i = 0; i < st.size(); i++)
+                    bw[i * 4 + h] += r[st[i].socket * max_stacks + st[i].stack];
+            }
+        }
+    }
+    const size_t at = values.size();
+    values.resize(at + bw.size());
+    rate_scale(bw.data(), values.data() + at, bw.size(), 1 / 1000000.0);
+}
+
+// one row per bifurcated part with a device under it, for the live view:
+// the part's counters are the v event named Part<part_id>
+struct part_row{
+    uint32_t idx, v;
+    string name;
+};
+static vector<part_row> parts;
+
+static const vector<part_row>& part_rows(){
+    if (parts_valid) return parts;
+    parts.clear();
+    for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
+        for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
+            for (const auto& part : stack->parts) {
+                auto v = std::find(v_names.begin(), v_names.end(), "Part" + std::to_string(part.part_id));
+                if (v == v_names.end() || part.child_pci_devs.empty()) continue;
+                // the first endpoint names the part, switches list their ports after it
+                const struct pci* dev = &part.child_pci_devs[0];
+                for (const auto& pci_device : part.child_pci_devs)
+                    if (pci_device.header_type == 0) { dev = &pci_device; break; }
+                const string bus_no = get_bus_no(*dev);
+                if (ONLY.size() && !std::count(ONLY.begin(), ONLY.end(), bus_no)) continue;
+                const string vendor = pciDB.first.count(dev->vendor_id) ? pciDB.first.at(dev->vendor_id) : "unknown vendor";
+                const string device = pciDB.second.count(dev->vendor_id) && pciDB.second.at(dev->vendor_id).count(dev->device_id)
+                                    ? pciDB.second.at(dev->vendor_id).at(dev->device_id) : "unknown device";
+                part_row r;
+                r.idx = socket->socket_id * max_stacks + stack->iio_unit_id;
+                r.v = (uint32_t)(v - v_names.begin());
+                r.name = "S" + std::to_string(socket->socket_id) + " " + bus_no + " " + vendor + " " + device;
+                parts.push_back(r);
+            }
+        }
+    }
+    parts_valid = true;
+    return parts;
+}
+
+vector<string> pcie_part_names(){
+    vector<string> names;
+    for (auto r = part_rows().cbegin(); r != part_rows().cend(); ++r)
+        names.push_back(r->name);
+    return names;
+}
+
+// IBW, IBR, OBR, OBW MB/s of every pcie_part_names() row
+void pcie_part_values(vector<double>& values){
+    static vector<uint64> bw;
+    const vector<part_row>& rows = part_rows();
+    bw.assign(rows.size() * 4, 0);
+    if (rates.size())
+        for (size_t i = 0; i < rows.size(); i++)
+            for (uint32_t h = 0; h < h_shown(); h++)
+                bw[i * 4 + h] = rate_row(h, rows[i].v)[rows[i].idx];
+    const size_t at = values.size();
+    values.resize(at + bw.size());
+    rate_scale(bw.data(), values.data() + at, bw.size(), 1 / 1000000.0);
+}
+
+// overhead read slots, [socket * max_stacks + iio_unit_id]
+vector<string> pcie_read_names(){
+    vector<string> names(max_sockets * max_stacks);
+    for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
+        for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "S%d_%02x", socket->socket_id, stack->busno);
+            names[socket->socket_id * max_stacks + stack->iio_unit_id] = buf;
+        }
+    }
+    return names;
+}
+
+// MB/s of all four directions on each socket, every stack, from the last collect_data
+static void socket_mbps(vector<double>& out){
+    out.assign(max_sockets, 0.0);
+    if (rates.empty()) return;
+    for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
+        for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
+            const uint32_t idx = socket->socket_id * max_stacks + stack->iio_unit_id;
+            for (uint32_t h = 0; h < h_shown(); h++)
+                for (uint32_t v = 0; v < v_names.size(); v++)
+                    out[socket->socket_id] += rate_row(h, v)[idx] / 1000000.0;
+        }
+    }
+}
+
+void pcie_raw(vector<uint64>& raw, uint32& slice_ms){
+    raw = iio_raw;
+    slice_ms = iio_slice_ms;
+}
+
+// the rate half of collect_data, from recorded deltas
+void pcie_replay(const vector<uint64>& raw, uint32 slice_ms){
+    if (slice_ms == 0 || raw.size() < counters.size() * max_sockets * max_stacks) return;
+    size_rates();
+    for (auto counter = counters.cbegin(); counter != counters.cend(); ++counter)
+        rate_counter(*counter, &raw[(counter - counters.begin()) * row_len], slice_ms);
+}
+
+size_t pcie_raw_size(){
+    return counters.size() * max_sockets * max_stacks;
+}
+
+void pcie_write_csv(std::ostream& out){
+    vector<string> display_buffer = build_csv();
+    display(display_buffer, out);
+}
+
+void pcie_write_display(std::ostream& out){
+    vector<string> display_buffer = build_display(iios, pciDB);
+    display(display_buffer, out);
+}
+
+// load_events() from clean event names, replaces the event list; parses with
+// the icx control register layout, so it needs no PCM and runs on any cpu
+size_t pcie_load_events(const string& fn){
+    if (opcodeFieldMap.empty())
+        init_opcode_fields();
+    h_names.clear();
+    v_names.clear();
+    rates.clear();
+    parts_valid = false;
+    uint64_t value = 0;
+    icx_ccr layout(value);
+    counters = load_events(layout, fn.c_str());
+    return counters.size();
+}
+
+// drop events and iio tree before pcie_load_topology()
+void pcie_clear_topology(){
+    counters.clear();
+    iios.clear();
+    shown_valid = false;
+    parts_valid = false;
+    h_names.clear();
+    v_names.clear();
+    rates.clear();
+}
+
+static void save_pci(std::ostream& out, const char* tag, const struct pci& p){
+    out << tag << " " << (int)p.bdf.busno << " " << (int)p.bdf.devno << " " << (int)p.bdf.funcno << " "
+        << p.vendor_id << " " << p.device_id << " " << (int)p.header_type << " "
+        << (int)p.link_speed << " " << (int)p.link_width << "\n";
+}
+
+static struct pci load_pci(istringstream& iss){
+    struct pci p;
+    int bus, dev, func, header_type, speed, width;
+    iss >> bus >> dev >> func >> p.vendor_id >> p.device_id >> header_type >> speed >> width;
+    p.bdf.busno = (uint8_t)bus;
+    p.bdf.devno = (uint8_t)dev;
+    p.bdf.funcno = (uint8_t)func;
+    p.header_type = (uint8_t)header_type;
+    p.link_speed = (uint8_t)speed;
+    p.link_width = (uint8_t)width;
+    return p;
+}
+
+// events and iio tree as text lines, names last since they carry spaces
+void pcie_save_topology(std::ostream& out){
+    for (auto c = counters.cbegin(); c != counters.cend(); ++c)
+        out << "event " << c->h_id << " " << c->v_id << " " << c->idx << " " << c->multiplier << " " << c->divider
+            << " " << c->h_event_name << "\t" << c->v_event_name << "\n";
+    for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
+        out << "socket " << socket->socket_id << "\n";
+        for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
+            out << "stack " << stack->iio_unit_id << " " << (int)stack->busno << " " << stack->stack_name << "\n";
+            for (const auto& part : stack->parts) {
+                out << "part " << part.part_id << "\n";
+                save_pci(out, "root", part.root_pci_dev);
+                for (const auto& pci_device : part.child_pci_devs)
+                    save_pci(out, "pci", pci_device);
+            }
+        }
+    }
+}
+
+// one pcie_save_topology() line, false if it isn't one
+bool pcie_load_topology(const string& line){
+    shown_valid = false;
+    parts_valid = false;
+    istringstream iss(line);
+    string tag;
+    iss >> tag;
+    if (tag == "event"){
+        struct counter ctr{};
+        iss >> ctr.h_id >> ctr.v_id >> ctr.idx >> ctr.multiplier >> ctr.divider;
+        string names;
+        getline(iss >> std::ws, names);
+        ctr.h_event_name = names.substr(0, names.find('\t'));
+        ctr.v_event_name = names.find('\t') == string::npos ? "" : names.substr(names.find('\t') + 1);
+        // ids come from the names, recordings may carry another numbering
+        ctr.h_id = intern(h_names, ctr.h_event_name);
+        ctr.v_id = intern(v_names, ctr.v_event_name);
+        counters.push_back(ctr);
+    }else if (tag == "socket"){
+        struct iio_stacks_on_socket s;
+        iss >> s.socket_id;
+        iios.push_back(s);
+    }else if (tag == "stack" && iios.size()){
+        struct iio_stack stack;
+        int busno;
+        iss >> stack.iio_unit_id >> busno;
+        stack.busno = (uint8_t)busno;
+        iss.get();
+        getline(iss, stack.stack_name);
+        iios.back().stacks.push_back(stack);
+    }else if (tag == "part" && iios.size() && iios.back().stacks.size()){
+        struct iio_bifurcated_part part;
+        iss >> part.part_id;
+        iios.back().stacks.back().parts.push_back(part);
+    }else if ((tag == "root" || tag == "pci") && iios.size() && iios.back().stacks.size() && iios.back().stacks.back().parts.size()){
+        struct iio_bifurcated_part& part = iios.back().stacks.back().parts.back();
+        if (tag == "root")
+            part.root_pci_dev = load_pci(iss);
+        else
+            part.child_pci_devs.push_back(load_pci(iss));
+    }else{
+        return false;
+    }
+    return true;
+}
+
+int pcie_main(int argc, char** argv) {
     cxxopts::Options options("pcie", "pcie performance monitor tool");
     options.add_options()
         ("g,debug",   "Enable debug info",    cxxopts::value<bool>()->default_value("false"))
@@ -798,9 +1256,17 @@ int main(int argc, char** argv) {
         ("o,output",  "Write to csv file",    cxxopts::value<string>()->default_value(""))
         ("s,delay",   "Seconds/update",       cxxopts::value<float>()->default_value("2.0"))
         ("l,only",    "Show only pcie list",  cxxopts::value<string>()->default_value(""))
+        ("e,energy",  "Add socket package/DRAM watts and pcie GB/s per watt to each row", cxxopts::value<bool>()->default_value("false"))
+        ("live",      "Live view of the busiest devices redrawn in place; keys: / filter, s sort, q quit", cxxopts::value<bool>()->default_value("false"))
+        ("k,top",     "Devices shown by --live, 0 fits the screen", cxxopts::value<int>()->default_value("0"))
         ("h,help",    "Print usage")
-        //("n,duration","Duration",           cxxopts::value<int>()->default_value("60"))
     ;
+    add_trigger_options(options);
+    add_run_options(options);
+    add_alert_options(options);
+    add_detect_options(options);
+    add_ecam_options(options);
+    add_overhead_options(options);
     auto result = options.parse(argc, argv);
     if (result.count("help")){
       std::cout << options.help() << std::endl;
@@ -816,54 +1282,25 @@ int main(int argc, char** argv) {
     split_only(s_only);
     OUT_FILE=result["output"].as<string>();
 
-    vector<struct counter> counters;
-    PCIDB pciDB;
-    load_PCIDB(pciDB);
-    bool csv = false;
     MainLoop mainLoop;
     PCM * m = PCM::getInstance();
-
-    string ev_file_name;
-    if (m->IIOEventsAvailable()){
-        ev_file_name = "opCode-" + std::to_string(m->getCPUModel()) + ".txt";
-    }else{
-        cerr << "This CPU is not supported by PCM IIO tool! Program aborted\n";
-        exit(EXIT_FAILURE);
-    }
-    opcodeFieldMap["opcode"] = PCM::OPCODE;
-    opcodeFieldMap["ev_sel"] = PCM::EVENT_SELECT;
-    opcodeFieldMap["umask"] = PCM::UMASK;
-    opcodeFieldMap["reset"] = PCM::RESET;
-    opcodeFieldMap["edge_det"] = PCM::EDGE_DET;
-    opcodeFieldMap["ignored"] = PCM::IGNORED;
-    opcodeFieldMap["overflow_enable"] = PCM::OVERFLOW_ENABLE;
-    opcodeFieldMap["en"] = PCM::ENABLE;
-    opcodeFieldMap["invert"] = PCM::INVERT;
-    opcodeFieldMap["thresh"] = PCM::THRESH;
-    opcodeFieldMap["ch_mask"] = PCM::CH_MASK;
-    opcodeFieldMap["fc_mask"] = PCM::FC_MASK;
-    opcodeFieldMap["hname"] =PCM::H_EVENT_NAME;
-    opcodeFieldMap["vname"] =PCM::V_EVENT_NAME;
-    opcodeFieldMap["multiplier"] = PCM::MULTIPLIER;
-    opcodeFieldMap["divider"] = PCM::DIVIDER;
-    opcodeFieldMap["ctr"] = PCM::COUNTER_INDEX;
-
-    counters = load_events(m, ev_file_name.c_str());
-
-    auto mapping = IPlatformMapping::getPlatformMapping(m->getCPUModel());
-    if (!mapping) {
-        cerr << "Failed to discover pci tree: unknown platform" << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    std::vector<struct iio_stacks_on_socket> iios;
-    if (!mapping->pciTreeDiscover(iios, m->getNumSockets())) {
+    ecam_setup(result);
+    pcie_setup(m);
+    if (delay < pcie_min_delay()){
+        cerr << "pcie: -s " << delay << " is below " << pcie_min_delay() << "s, 1 ms per pcie event" << endl;
         exit(EXIT_FAILURE);
     }
+    trigger_setup(result, pcie_columns(), pcie_min_delay());
+    alert_setup(result, pcie_columns());
+    detect_setup(result, pcie_columns());
+    const float coarse = delay;
+    vector<double> values;
+    run_setup(result);
+    overhead_setup(result, pcie_read_names());
 
     if (DEBUG){
         print_cpu_details();
-        print_nameMap();
+        print_event_names();
         print_PCIeMapping(iios, pciDB);
     }
     std::fstream file_stream;
@@ -871,16 +1308,69 @@ int main(int argc, char** argv) {
         file_stream.open(OUT_FILE.c_str(), std::ios_base::out);
         OUT = &file_stream;
     }
+    // the live view owns the terminal, the csv still goes to -o
+    const bool live = result["live"].as<bool>();
+    vector<double> partValues;
+    if (live)
+        top_setup(result["top"].as<int>(), pcie_part_names());
+
+    const bool energy = result["energy"].as<bool>() && energy_setup(m);
+    vector<ServerUncoreCounterState> energyBefore, energyAfter;
+    vector<double> mbps, energyValues;
+    uint64 energyTime = 0;
+    if (energy){
+        const uint32 numSockets = m->getNumSockets();
+        for (auto c : energy_columns(1))
+            csv_extra_header.push_back(c.substr(2));
+        csv_extra.assign(numSockets, vector<double>());
+        energy_read(m, energyBefore);
+        energyTime = m->getTickCount();
+    }
 
     mainLoop([&](){
         collect_data(m, delay, iios, counters);
+        if (energy){
+            energy_read(m, energyAfter);
+            const uint64 now = m->getTickCount();
+            socket_mbps(mbps);
+            energyValues.clear();
+            energy_values((uint32)energyAfter.size(), energyBefore, energyAfter, now - energyTime, mbps, energyValues);
+            for (size_t i = 0; i < csv_extra.size(); i++)
+                csv_extra[i].assign(energyValues.begin() + i * 4, energyValues.begin() + (i + 1) * 4);
+            swap(energyBefore, energyAfter);
+            energyTime = now;
+        }
         //vector<string> display_buffer = csv ? build_csv(iios, counters, true) : build_display(iios, counters, pciDB);
-        vector<string> display_buffer = build_csv(iios, counters, pciDB);
-        display(display_buffer, *OUT);
+        uint64 t = overhead_clock();
+        if (live){
+            partValues.clear();
+            pcie_part_values(partValues);
+            top_update(partValues, currentDateTime());
+            overhead_add(OVERHEAD_WRITE, t);
+        }
+        if (!live || OUT_FILE.size()){
+            t = overhead_clock();
+            vector<string> display_buffer = build_csv();
+            overhead_add(OVERHEAD_FORMAT, t);
+            t = overhead_clock();
+            display(display_buffer, *OUT);
+            overhead_add(OVERHEAD_WRITE, t);
+        }
+        values.clear();
+        pcie_values(values);
+        alert_check(values);
+        detect_check(values);
+        overhead_interval();
+        if (!run_continue(values)) return false;
+        delay = trigger_interval(values, coarse);
         return true;
     });
 
+    if (live) top_cleanup();
     file_stream.close();
+    run_summary(pcie_columns());
+    overhead_summary();
+    m->cleanup();
     exit(EXIT_SUCCESS);
 }
 
@@ -0,0 +1,250 @@
+#include "cpucounters.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "pmt.h"
+
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define PMT_IO_URING 1
+#endif
+#endif
+
+using namespace std;
+using namespace pcm;
+
+// Which bus:dev.fn of segment 0 exist, learned before discovery probes them.
+// The IIO tree walk calls probe_pci() on every function of every bus, about
+// 65k opens of /proc/bus/pci/BB/DD.F per socket that nearly all fail. Here
+// the bus directories, then the functions of the buses that exist, are
+// opened and their vendor ids read through io_uring in batches of up to
+// ring_entries, once for all sockets: a few io_uring_enter() calls and a
+// close() per present function. A batch holds its opens at once, so it is
+// also kept below the free descriptors of RLIMIT_NOFILE. Only ENOENT/ENOTDIR
+// mean absent: any other error, or no io_uring at all (old headers or
+// kernel, seccomp), leaves nothing known and pci_maybe_present() says yes
+// to everything: the old path.
+static const char* proc_root = "/proc/bus/pci";
+static const unsigned ring_entries = 4096;
+static bool scanned = false;
+static vector<bool> present;        // [bus << 8 | dev << 3 | fn]
+
+#ifdef PMT_IO_URING
+struct uring{
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+};
+
+static bool uring_open(uring& r, unsigned entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r.fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r.fd < 0) return false;
+    r.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r.sq_len = r.cq_len = (std::max)(r.sq_len, r.cq_len);
+    r.sq_ptr = mmap(NULL, r.sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQ_RING);
+    r.cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? r.sq_ptr
+             : mmap(NULL, r.cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_CQ_RING);
+    r.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r.sqes = (struct io_uring_sqe*)mmap(NULL, r.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQES);
+    if (r.sq_ptr == MAP_FAILED || r.cq_ptr == MAP_FAILED || r.sqes == MAP_FAILED){
+        close(r.fd);
+        return false;
+    }
+    char* sq = (char*)r.sq_ptr;
+    char* cq = (char*)r.cq_ptr;
+    r.sq_head = (unsigned*)(sq + p.sq_off.head);
+    r.sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r.sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    r.sq_array = (unsigned*)(sq + p.sq_off.array);
+    r.cq_head = (unsigned*)(cq + p.cq_off.head);
+    r.cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r.cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    r.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+static void uring_close(uring& r){
+    munmap(r.sqes, r.sqes_len);
+    if (r.cq_ptr != r.sq_ptr) munmap(r.cq_ptr, r.cq_len);
+    munmap(r.sq_ptr, r.sq_len);
+    close(r.fd);
+}
+
+static struct io_uring_sqe* uring_sqe(uring& r){
+    const unsigned tail = *r.sq_tail;
+    const unsigned i = tail & *r.sq_mask;
+    r.sq_array[i] = i;
+    struct io_uring_sqe* sqe = &r.sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(r.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+// submit n queued sqes and wait for them, res[user_data] = cqe res
+static bool uring_run(uring& r, unsigned n, vector<int>& res, unsigned& calls){
+    unsigned done = 0, submit = n;
+    while (done < n){
+        const int ret = (int)syscall(__NR_io_uring_enter, r.fd, submit, n - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        calls++;
+        if (ret < 0 && errno != EINTR) return false;
+        if (ret > 0) submit -= (std::min)((unsigned)ret, submit);
+        unsigned head = *r.cq_head;
+        while (head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)){
+            const struct io_uring_cqe& cqe = r.cqes[head & *r.cq_mask];
+            if (cqe.user_data < res.size()) res[cqe.user_data] = cqe.res;
+            head++;
+            done++;
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+// descriptors a batch may hold open: the soft RLIMIT_NOFILE less those in
+// use and a few for whatever else runs meanwhile
+static unsigned free_fds(){
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return 0;
+    unsigned used = 0;
+    DIR* d = opendir("/proc/self/fd");
+    if (d){
+        while (readdir(d)) used++;
+        closedir(d);
+    }
+    const rlim_t margin = used + 16;
+    if (rl.rlim_cur == RLIM_INFINITY) return ring_entries;
+    return rl.rlim_cur > margin ? (unsigned)(std::min)(rl.rlim_cur - margin, (rlim_t)ring_entries) : 0;
+}
+
+// open batches of paths, fds[i] >= 0 where paths[i] opened, -ENOENT where
+// it doesn't exist; false on any other error, nothing can be concluded then
+static bool uring_probe(uring& r, const vector<string>& paths, unsigned first, unsigned n, vector<int>& fds, unsigned& calls){
+    for (unsigned i = 0; i < n; i++){
+        struct io_uring_sqe* sqe = uring_sqe(r);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)paths[first + i].c_str();
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = i;
+    }
+    std::fill(fds.begin(), fds.end(), -EIO);
+    bool ok = uring_run(r, n, fds, calls);
+    // -EINVAL: the kernel has io_uring but not IORING_OP_OPENAT, -EMFILE,
+    // -EACCES and the like: the function may well be there
+    for (unsigned i = 0; i < n; i++){
+        if (fds[i] == -ENOTDIR) fds[i] = -ENOENT;
+        if (fds[i] < 0 && fds[i] != -ENOENT) ok = false;
+    }
+    if (!ok)
+        for (unsigned i = 0; i < n; i++)
+            if (fds[i] >= 0) close(fds[i]);
+    return ok;
+}
+
+static bool scan_uring(){
+    const unsigned batch = free_fds();
+    if (batch == 0) return false;
+    uring r;
+    if (!uring_open(r, ring_entries)) return false;
+    const unsigned total = 256 * 32 * 8;
+    vector<string> paths;
+    vector<int> fds(ring_entries), res(ring_entries);
+    vector<uint32_t> ids(ring_entries);
+    vector<unsigned> funcs, open_idx;
+    unsigned calls = 0, found = 0;
+    char buf[64];
+    present.assign(total, false);
+
+    // buses first: a bus without a directory has no functions to try
+    for (unsigned bus = 0; bus < 256; bus++){
+        snprintf(buf, sizeof(buf), "%s/%02x", proc_root, bus);
+        paths.push_back(buf);
+    }
+    bool ok = true;
+    for (unsigned base = 0; base < 256 && ok; base += batch){
+        const unsigned n = (std::min)(batch, 256 - base);
+        ok = uring_probe(r, paths, base, n, fds, calls);
+        for (unsigned i = 0; i < n && ok; i++){
+            if (fds[i] < 0) continue;
+            close(fds[i]);
+            for (unsigned f = (base + i) << 8; f < (base + i + 1) << 8; f++)
+                funcs.push_back(f);
+        }
+    }
+    paths.clear();
+    for (auto f = funcs.cbegin(); f != funcs.cend(); ++f){
+        snprintf(buf, sizeof(buf), "%s/%02x/%02x.%x", proc_root, *f >> 8, (*f >> 3) & 0x1f, *f & 7);
+        paths.push_back(buf);
+    }
+
+    for (unsigned base = 0; base < funcs.size() && ok; base += batch){
+        const unsigned n = (std::min)(batch, (unsigned)funcs.size() - base);
+        if (!uring_probe(r, paths, base, n, fds, calls)) { ok = false; break; }
+        open_idx.clear();
+        for (unsigned i = 0; i < n; i++)
+            if (fds[i] >= 0) open_idx.push_back(i);
+        if (open_idx.empty()) continue;
+        for (auto i = open_idx.cbegin(); i != open_idx.cend(); ++i){
+            struct io_uring_sqe* sqe = uring_sqe(r);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fds[*i];
+            sqe->addr = (unsigned long)&ids[*i];
+            sqe->len = 4;
+            sqe->off = 0;
+            sqe->user_data = *i;
+        }
+        std::fill(res.begin(), res.end(), -EIO);
+        ok = uring_run(r, (unsigned)open_idx.size(), res, calls);
+        // a failed read proves nothing, probe_pci() gets to try it
+        for (auto i = open_idx.cbegin(); i != open_idx.cend(); ++i){
+            if (res[*i] != 4 || (ids[*i] & 0xffff) != 0xffff){
+                present[funcs[base + *i]] = true;
+                found++;
+            }
+            close(fds[*i]);
+        }
+    }
+    uring_close(r);
+    if (DEBUG && ok)
+        cerr << "pci scan: " << found << " functions on " << funcs.size() / 256 << " buses, " << calls << " io_uring_enter calls" << endl;
+    return ok;
+}
+#endif
+
+// true unless the batched scan found nothing at bus:dev.fn
+bool pci_maybe_present(uint32 bus, uint32 dev, uint32 fn){
+    if (!scanned){
+        scanned = true;
+#ifdef PMT_IO_URING
+        const auto t0 = std::chrono::steady_clock::now();
+        if (!scan_uring()){
+            present.clear();
+            if (DEBUG) cerr << "pci scan: io_uring unavailable or failed, probing every function" << endl;
+        }else if (DEBUG){
+            cerr << "pci scan: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() << " ms" << endl;
+        }
+#endif
+    }
+    if (present.empty()) return true;
+    return present[(bus & 0xff) << 8 | (dev & 0x1f) << 3 | (fn & 7)];
+}
@@ -0,0 +1,197 @@
+#ifndef PMT_H
+#define PMT_H
+
+#include "cpucounters.h"
+#include <string>
+#include <iosfwd>
+#include <vector>
+#include <signal.h>
+
+namespace cxxopts { class Options; class ParseResult; }
+
+// lspci.h and pcm-pcie.h carry definitions, keep them in one translation unit each:
+// pcie.cpp owns the iio topology and event list, mem.cpp owns the IPlatform.
+
+// shared by all subcommands, defined in main.cpp
+extern std::string OUT_FILE;
+extern float delay;
+extern bool DEBUG;
+extern volatile sig_atomic_t STOP;
+
+std::string currentDateTime();
+pcm::uint64 epochMs();
+std::string formatDateTime(pcm::uint64 epoch_ms);
+void write_values(std::ostream& out, const std::string& time, const std::vector<double>& row, bool csv);
+void run_signals();
+void add_run_options(cxxopts::Options& options);
+void run_setup(const cxxopts::ParseResult& result);
+bool run_continue(const std::vector<double>& values);
+void run_summary(const std::vector<std::string>& columns);
+
+// mem.cpp
+extern bool SHOW_CHANNELS;
+extern bool SHOW_MEMORY;
+extern bool SHOW_LATENCY;
+extern bool SHOW_UPI;
+extern bool SHOW_ENERGY;
+extern bool SHOW_RESCTRL;
+int mem_main(int argc, char** argv);
+void mem_setup(pcm::PCM *m);
+void mem_setup(pcm::uint32 channels);
+pcm::uint32 mem_channels();
+std::vector<std::string> mem_columns(pcm::uint32 numSockets);
+// IMC channel counters of every socket, [socket * mem_channels() + channel]
+struct imc_state{
+    std::vector<pcm::uint64> reads, writes;
+    std::vector<pcm::uint64> read_occ, write_occ, clocks;   // --latency only
+    pcm::SystemCounterState upi;                            // --upi only
+    std::vector<pcm::ServerUncoreCounterState> energy;      // --energy only
+    std::vector<pcm::uint64> mbm;                           // --groups only
+    std::vector<pcm::IIOCounterState> iio;                  // -p only
+};
+void imc_setup(pcm::PCM *m);
+void imc_read(pcm::uint32 socket, imc_state& s);
+void imc_read(imc_state& s);
+void imc_deltas(const imc_state& before, const imc_state& after, std::vector<pcm::uint64>& reads, std::vector<pcm::uint64>& writes);
+void mem_rates(pcm::uint32 numSockets, const std::vector<pcm::uint64>& channelReads, const std::vector<pcm::uint64>& channelWrites, const pcm::uint64 elapsedTime, std::vector<double>& values);
+void mem_upi(pcm::uint32 socket, const imc_state& before, const imc_state& after, const pcm::uint64 elapsedTime, std::vector<double>& values);
+void mem_latency(pcm::uint32 numSockets, const imc_state& before, const imc_state& after, const pcm::uint64 elapsedTime, std::vector<double>& values);
+void mem_values(pcm::uint32 numSockets, const imc_state& before, const imc_state& after, const pcm::uint64 elapsedTime, std::vector<double>& values);
+void printMemBW(pcm::uint32 numSockets, const imc_state& before, const imc_state& after, const pcm::uint64 elapsedTime, std::vector<double>& values);
+
+// pcie.cpp
+int pcie_main(int argc, char** argv);
+void split_only(std::string ids);
+void pcie_setup(pcm::PCM *m);
+void pcie_collect(pcm::PCM *m, const double delay);
+float pcie_min_delay();
+void pcie_wait_hook(void (*fn)(double seconds));
+bool pcie_window_setup(pcm::PCM *m);
+void pcie_window_read(pcm::PCM *m, std::vector<pcm::IIOCounterState>& states);
+void pcie_window_values(const std::vector<pcm::IIOCounterState>& before, const std::vector<pcm::IIOCounterState>& after, const pcm::uint64 elapsedTime, std::vector<double>& values);
+std::vector<std::string> pcie_columns();
+void pcie_values(std::vector<double>& values);
+std::vector<std::string> pcie_read_names();
+std::vector<std::string> pcie_part_names();
+void pcie_part_values(std::vector<double>& values);
+void pcie_raw(std::vector<pcm::uint64>& raw, pcm::uint32& slice_ms);
+size_t pcie_raw_size();
+void pcie_replay(const std::vector<pcm::uint64>& raw, pcm::uint32 slice_ms);
+void pcie_write_csv(std::ostream& out);
+void pcie_write_display(std::ostream& out);
+size_t pcie_load_events(const std::string& fn);
+void pcie_clear_topology();
+void pcie_save_topology(std::ostream& out);
+bool pcie_load_topology(const std::string& line);
+
+// detect.cpp
+void add_detect_options(cxxopts::Options& options);
+void detect_setup(const cxxopts::ParseResult& result, const std::vector<std::string>& columns);
+void detect_check(const std::vector<double>& values);
+
+// top.cpp
+void top_setup(int n, const std::vector<std::string>& device_names);
+void top_update(const std::vector<double>& values, const std::string& time);
+void top_cleanup();
+
+// pciscan.cpp
+bool pci_maybe_present(pcm::uint32 bus, pcm::uint32 dev, pcm::uint32 fn);
+
+// rate.cpp
+bool rate_force_isa(const std::string& isa);
+const char* rate_isa();
+void rate_delta(const pcm::uint64* before, const pcm::uint64* after, pcm::uint64* d, size_t n, pcm::uint64 mask);
+void rate_scale(const pcm::uint64* d, double* out, size_t n, double scale);
+void rate_scale_u64(const pcm::uint64* d, pcm::uint64* out, size_t n, double scale);
+
+// ecam.cpp
+void add_ecam_options(cxxopts::Options& options);
+void ecam_setup(const cxxopts::ParseResult& result);
+bool ecam_active();
+pcm::uint32 ecam_read32(pcm::uint32 bus, pcm::uint32 dev, pcm::uint32 fn, pcm::uint32 reg);
+
+// energy.cpp
+bool energy_setup(pcm::PCM *m);
+void energy_read(pcm::PCM *m, std::vector<pcm::ServerUncoreCounterState>& states);
+std::vector<std::string> energy_columns(pcm::uint32 numSockets);
+void energy_values(pcm::uint32 numSockets, const std::vector<pcm::ServerUncoreCounterState>& before, const std::vector<pcm::ServerUncoreCounterState>& after,
+                   const pcm::uint64 elapsedTime, const std::vector<double>& socket_mbps, std::vector<double>& values);
+
+// resctrl.cpp
+void add_resctrl_options(cxxopts::Options& options);
+bool resctrl_setup(const cxxopts::ParseResult& result);
+std::vector<std::string> resctrl_columns();
+void resctrl_read(std::vector<pcm::uint64>& out);
+void resctrl_values(const std::vector<pcm::uint64>& before, const std::vector<pcm::uint64>& after, const pcm::uint64 elapsedTime, std::vector<double>& values);
+void resctrl_cleanup();
+pcm::uint64 resctrl_counter(const std::string& path);
+
+// mba.cpp
+int mba_main(int argc, char** argv);
+
+// sampler.cpp
+void sampler_setup(pcm::PCM *m, bool pcie);
+void sampler_reset(pcm::PCM *m);
+std::vector<std::string> sampler_columns();
+void sampler_wait(pcm::PCM *m, double seconds);
+pcm::uint64 sampler_read(pcm::PCM *m, std::vector<double>& values);
+void sampler_raw(std::vector<pcm::uint64>& reads, std::vector<pcm::uint64>& writes);
+void sampler_cleanup();
+
+// daemon.cpp
+int daemon_main(int argc, char** argv);
+
+// alert.cpp
+void add_alert_options(cxxopts::Options& options);
+void alert_setup(const cxxopts::ParseResult& result, const std::vector<std::string>& columns);
+void alert_check(const std::vector<double>& values);
+
+// trigger.cpp
+void add_trigger_options(cxxopts::Options& options);
+void trigger_setup(const cxxopts::ParseResult& result, const std::vector<std::string>& columns, float min_delay);
+float trigger_interval(const std::vector<double>& values, float coarse);
+
+// stats.cpp
+struct metric_stats{
+    pcm::uint64 n;
+    double mean, m2, min, max;
+    std::vector<pcm::uint32> hist;
+    void reset();
+    void add(double v);
+    double stddev() const;
+    double percentile(double p) const;
+};
+void add_stats_options(cxxopts::Options& options);
+bool stats_setup(const cxxopts::ParseResult& result, size_t ncols);
+std::vector<std::string> stats_columns(const std::vector<std::string>& columns);
+bool stats_pending();
+bool stats_add(const std::vector<double>& values, pcm::uint64 elapsed_ms);
+void stats_values(std::vector<double>& out);
+
+// overhead.cpp
+enum { OVERHEAD_FORMAT, OVERHEAD_WRITE, OVERHEAD_READ };
+void add_overhead_options(cxxopts::Options& options);
+void overhead_setup(const cxxopts::ParseResult& result, const std::vector<std::string>& read_names);
+pcm::uint64 overhead_clock();
+void overhead_add(int slot, pcm::uint64 since);
+void overhead_sleep(double seconds);
+void overhead_interval();
+void overhead_summary();
+
+// flight.cpp
+int flight_main(int argc, char** argv);
+
+// hires.cpp
+int hires_main(int argc, char** argv);
+
+// replay.cpp
+int record_main(int argc, char** argv);
+int replay_main(int argc, char** argv);
+
+// core.cpp
+int core_main(int argc, char** argv);
+
+// bench.cpp, only linked into the bench target (-DPMT_BENCH)
+int bench_main(int argc, char** argv);
+
+#endif
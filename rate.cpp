@@ -0,0 +1,197 @@
+#include "cpucounters.h"
+#include <iostream>
+#include <string>
+#include <math.h>
+#include "pmt.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PMT_RATE_X86 1
+#endif
+
+using namespace std;
+using namespace pcm;
+
+// Delta and rate kernels every output path shares. Counter snapshots are
+// structure of arrays, one uint64 per socket/channel or socket/stack slot,
+// so an interval is a few passes over contiguous arrays:
+//   rate_delta      d = (after - before) & mask, a mask-wide counter's wrap
+//   rate_scale      out = d * k rounded to two decimals (MB/s columns)
+//   rate_scale_u64  out = d * k truncated (iio bytes/s)
+// The AVX-512 (F+DQ) or AVX2 variant is picked from cpuid at the first call,
+// or by rate_force_isa(). Every variant does the same IEEE operations in the
+// same order as the scalar loop, which also takes the tails, so the choice
+// never changes a printed value.
+typedef void (*delta_fn)(const uint64*, const uint64*, uint64*, size_t, uint64);
+typedef void (*scale_fn)(const uint64*, double*, size_t, double);
+typedef void (*scale_u64_fn)(const uint64*, uint64*, size_t, double);
+
+struct rate_kernels{
+    const char* isa;
+    delta_fn delta;
+    scale_fn scale;
+    scale_u64_fn scale_u64;
+};
+
+static void delta_scalar(const uint64* b, const uint64* a, uint64* d, size_t n, uint64 mask){
+    for (size_t i = 0; i < n; i++)
+        d[i] = (a[i] - b[i]) & mask;
+}
+
+static void scale_scalar(const uint64* d, double* out, size_t n, double k){
+    for (size_t i = 0; i < n; i++)
+        out[i] = nearbyint((double)d[i] * k * 100) / 100;
+}
+
+static void scale_u64_scalar(const uint64* d, uint64* out, size_t n, double k){
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint64)((double)d[i] * k);
+}
+
+#ifdef PMT_RATE_X86
+// uint64 -> double correctly rounded, as the scalar conversion: 2^84 + hi
+// and 2^52 + lo are exact doubles, one rounding in the final add
+__attribute__((target("avx2")))
+static inline __m256d u64_to_pd_avx2(__m256i x){
+    const __m256i hi = _mm256_or_si256(_mm256_srli_epi64(x, 32), _mm256_castpd_si256(_mm256_set1_pd(19342813113834066795298816.)));
+    const __m256i lo = _mm256_blend_epi32(x, _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.)), 0xaa);
+    const __m256d h = _mm256_sub_pd(_mm256_castsi256_pd(hi), _mm256_set1_pd(19342813118337666422669312.));
+    return _mm256_add_pd(h, _mm256_castsi256_pd(lo));
+}
+
+__attribute__((target("avx2")))
+static void delta_avx2(const uint64* b, const uint64* a, uint64* d, size_t n, uint64 mask){
+    const __m256i m = _mm256_set1_epi64x((long long)mask);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        const __m256i x = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+        _mm256_storeu_si256((__m256i*)(d + i), _mm256_and_si256(x, m));
+    }
+    delta_scalar(b + i, a + i, d + i, n - i, mask);
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(const uint64* d, double* out, size_t n, double k){
+    const __m256d vk = _mm256_set1_pd(k), hundred = _mm256_set1_pd(100);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        const __m256d x = _mm256_mul_pd(_mm256_mul_pd(u64_to_pd_avx2(_mm256_loadu_si256((const __m256i*)(d + i))), vk), hundred);
+        _mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_round_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), hundred));
+    }
+    scale_scalar(d + i, out + i, n - i, k);
+}
+
+// double -> uint64 through 2^52 + x below 2^52, lanes past it go scalar
+__attribute__((target("avx2")))
+static void scale_u64_avx2(const uint64* d, uint64* out, size_t n, double k){
+    const __m256d vk = _mm256_set1_pd(k), two52 = _mm256_set1_pd(4503599627370496.);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        const __m256d x = _mm256_round_pd(_mm256_mul_pd(u64_to_pd_avx2(_mm256_loadu_si256((const __m256i*)(d + i))), vk), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        if (_mm256_movemask_pd(_mm256_cmp_pd(x, two52, _CMP_NLT_UQ))){
+            scale_u64_scalar(d + i, out + i, 4, k);
+            continue;
+        }
+        const __m256i bits = _mm256_xor_si256(_mm256_castpd_si256(_mm256_add_pd(x, two52)), _mm256_castpd_si256(two52));
+        _mm256_storeu_si256((__m256i*)(out + i), bits);
+    }
+    scale_u64_scalar(d + i, out + i, n - i, k);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static void delta_avx512(const uint64* b, const uint64* a, uint64* d, size_t n, uint64 mask){
+    const __m512i m = _mm512_set1_epi64((long long)mask);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        const __m512i x = _mm512_sub_epi64(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        _mm512_storeu_si512(d + i, _mm512_and_si512(x, m));
+    }
+    delta_scalar(b + i, a + i, d + i, n - i, mask);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static void scale_avx512(const uint64* d, double* out, size_t n, double k){
+    const __m512d vk = _mm512_set1_pd(k), hundred = _mm512_set1_pd(100);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        const __m512d x = _mm512_mul_pd(_mm512_mul_pd(_mm512_cvtepu64_pd(_mm512_loadu_si512(d + i)), vk), hundred);
+        _mm512_storeu_pd(out + i, _mm512_div_pd(_mm512_mask_roundscale_pd(x, 0xff, x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), hundred));
+    }
+    scale_scalar(d + i, out + i, n - i, k);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static void scale_u64_avx512(const uint64* d, uint64* out, size_t n, double k){
+    const __m512d vk = _mm512_set1_pd(k);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        const __m512d x = _mm512_mul_pd(_mm512_cvtepu64_pd(_mm512_loadu_si512(d + i)), vk);
+        _mm512_storeu_si512(out + i, _mm512_cvttpd_epu64(x));
+    }
+    scale_u64_scalar(d + i, out + i, n - i, k);
+}
+#endif
+
+static const rate_kernels scalar_kernels = {"scalar", delta_scalar, scale_scalar, scale_u64_scalar};
+#ifdef PMT_RATE_X86
+static const rate_kernels avx2_kernels = {"avx2", delta_avx2, scale_avx2, scale_u64_avx2};
+static const rate_kernels avx512_kernels = {"avx512", delta_avx512, scale_avx512, scale_u64_avx512};
+#endif
+
+static const rate_kernels* pick(){
+#ifdef PMT_RATE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+        return &avx512_kernels;
+    if (__builtin_cpu_supports("avx2"))
+        return &avx2_kernels;
+#endif
+    return &scalar_kernels;
+}
+
+static const rate_kernels* kernels = NULL;
+
+static const rate_kernels& k(){
+    if (!kernels) kernels = pick();
+    return *kernels;
+}
+
+// auto, scalar, avx2 or avx512; false when this cpu can't run it
+bool rate_force_isa(const string& isa){
+    const rate_kernels* best = pick();
+    if (isa == "auto"){
+        kernels = best;
+        return true;
+    }
+    if (isa == "scalar"){
+        kernels = &scalar_kernels;
+        return true;
+    }
+#ifdef PMT_RATE_X86
+    if (isa == "avx2" && best != &scalar_kernels){
+        kernels = &avx2_kernels;
+        return true;
+    }
+    if (isa == "avx512" && best == &avx512_kernels){
+        kernels = &avx512_kernels;
+        return true;
+    }
+#endif
+    return false;
+}
+
+const char* rate_isa(){
+    return k().isa;
+}
+
+void rate_delta(const uint64* before, const uint64* after, uint64* d, size_t n, uint64 mask){
+    k().delta(before, after, d, n, mask);
+}
+
+void rate_scale(const uint64* d, double* out, size_t n, double scale){
+    k().scale(d, out, n, scale);
+}
+
+void rate_scale_u64(const uint64* d, uint64* out, size_t n, double scale){
+    k().scale_u64(d, out, n, scale);
+}
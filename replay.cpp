@@ -0,0 +1,240 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Record keeps what the PMU said, not what we made of it: per interval the IMC
+// channel CAS counts, the iio event deltas and the window lengths, behind a
+// text header with the topology. Replay feeds them through mem_rates(),
+// pcie_replay(), the stats stage and the writers without touching the PMU.
+//
+//   pmt-record 1
+//   sockets <n> / channels <n> / iio <n>
+//   event ... / socket ... / stack ... / part ... / root ... / pci ...
+//   data
+//   records of: uint64 epoch_ms, uint64 elapsed_ms, uint32 slice_ms, uint32 0,
+//               uint64 reads[sockets*channels], uint64 writes[sockets*channels], uint64 iio[n]
+struct record{
+    uint64 epoch_ms;
+    uint64 elapsed_ms;
+    uint32 slice_ms;
+    vector<uint64> reads, writes, iio;
+};
+
+static bool write_record(std::ostream& out, const record& r){
+    const uint32 pad = 0;
+    out.write((const char*)&r.epoch_ms, sizeof(r.epoch_ms));
+    out.write((const char*)&r.elapsed_ms, sizeof(r.elapsed_ms));
+    out.write((const char*)&r.slice_ms, sizeof(r.slice_ms));
+    out.write((const char*)&pad, sizeof(pad));
+    out.write((const char*)r.reads.data(), r.reads.size() * sizeof(uint64));
+    out.write((const char*)r.writes.data(), r.writes.size() * sizeof(uint64));
+    out.write((const char*)r.iio.data(), r.iio.size() * sizeof(uint64));
+    return (bool)out;
+}
+
+static bool read_record(std::istream& in, record& r){
+    uint32 pad;
+    in.read((char*)&r.epoch_ms, sizeof(r.epoch_ms));
+    in.read((char*)&r.elapsed_ms, sizeof(r.elapsed_ms));
+    in.read((char*)&r.slice_ms, sizeof(r.slice_ms));
+    in.read((char*)&pad, sizeof(pad));
+    in.read((char*)r.reads.data(), r.reads.size() * sizeof(uint64));
+    in.read((char*)r.writes.data(), r.writes.size() * sizeof(uint64));
+    in.read((char*)r.iio.data(), r.iio.size() * sizeof(uint64));
+    return (bool)in;
+}
+
+int record_main(int argc, char** argv) {
+    cxxopts::Options options("record", "save raw counter deltas for replay");
+    options.add_options()
+        ("g,debug",   "Enable debug info",    cxxopts::value<bool>()->default_value("false"))
+        ("o,output",  "Record file",          cxxopts::value<string>()->default_value("pmt.rec"))
+        ("s,delay",   "Seconds/update",       cxxopts::value<float>()->default_value("1.0"))
+        ("p,pcie",    "Record pcie events",   cxxopts::value<bool>()->default_value("false"))
+        ("h,help",    "Print usage")
+    ;
+    add_run_options(options);
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    DEBUG = result["debug"].as<bool>();
+    OUT_FILE = result["output"].as<string>();
+    delay = result["delay"].as<float>();
+    const bool pcie = result["pcie"].as<bool>();
+    SHOW_MEMORY = true;
+
+    PCM *m = PCM::getInstance();
+    PCM::ErrorCode returnResult = m->program();
+    if (returnResult != PCM::Success) {
+        std::cerr << "PCM couldn't start" << std::endl;
+        std::cerr << "Error code: " << returnResult << std::endl;
+        exit(1);
+    }
+    sampler_setup(m, pcie);
+
+    std::ofstream out(OUT_FILE.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!out.is_open()){
+        cerr << "record: can't open " << OUT_FILE << endl;
+        exit(EXIT_FAILURE);
+    }
+    const uint32 numSockets = m->getNumSockets();
+    record r;
+    r.reads.resize(numSockets * mem_channels());
+    r.writes.resize(numSockets * mem_channels());
+    r.iio.resize(pcie ? pcie_raw_size() : 0);
+    out << "pmt-record 1\n";
+    out << "sockets " << numSockets << "\n";
+    out << "channels " << mem_channels() << "\n";
+    out << "iio " << r.iio.size() << "\n";
+    if (pcie)
+        pcie_save_topology(out);
+    out << "data\n";
+
+    run_setup(result);
+    vector<double> values;
+    for (;;){
+        sampler_wait(m, delay);
+        r.elapsed_ms = sampler_read(m, values);
+        r.epoch_ms = epochMs();
+        sampler_raw(r.reads, r.writes);
+        r.slice_ms = 0;
+        if (pcie)
+            pcie_raw(r.iio, r.slice_ms);
+        if (!write_record(out, r)){
+            cerr << "record: write to " << OUT_FILE << " failed" << endl;
+            break;
+        }
+        if (!run_continue(values)) break;
+    }
+    out.close();
+    run_summary(sampler_columns());
+    sampler_cleanup();
+    m->cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+int replay_main(int argc, char** argv) {
+    cxxopts::Options options("replay", "run a record through rates, stats and writers");
+    options.add_options()
+        ("i,input",   "Record file",          cxxopts::value<string>()->default_value("pmt.rec"))
+        ("o,output",  "Write to csv file",    cxxopts::value<string>()->default_value(""))
+        ("c,channels","Show memory channels", cxxopts::value<bool>()->default_value("false"))
+        ("l,only",    "Show only pcie list",  cxxopts::value<string>()->default_value(""))
+        ("w,writer",  "all (one row) or pcie (pcie tool csv)", cxxopts::value<string>()->default_value("all"))
+        ("loops",     "Replay the record this many times", cxxopts::value<int>()->default_value("1"))
+        ("h,help",    "Print usage")
+    ;
+    add_stats_options(options);
+    auto result = options.parse(argc, argv);
+    if (result.count("help")){
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+    OUT_FILE = result["output"].as<string>();
+    SHOW_CHANNELS = result["channels"].as<bool>();
+    SHOW_MEMORY = true;
+    split_only(result["only"].as<string>());
+    const string writer = result["writer"].as<string>();
+    const int loops = (std::max)(1, result["loops"].as<int>());
+    const string input = result["input"].as<string>();
+
+    std::ifstream in(input.c_str(), std::ios_base::in | std::ios_base::binary);
+    string line;
+    if (!in.is_open() || !getline(in, line) || line != "pmt-record 1"){
+        cerr << "replay: " << input << " is not a pmt record" << endl;
+        exit(EXIT_FAILURE);
+    }
+    uint32 numSockets = 0, channels = 0;
+    size_t iio = 0;
+    while (getline(in, line) && line != "data"){
+        istringstream iss(line);
+        string tag;
+        iss >> tag;
+        if (tag == "sockets") iss >> numSockets;
+        else if (tag == "channels") iss >> channels;
+        else if (tag == "iio") iss >> iio;
+        else if (!pcie_load_topology(line))
+            cerr << "replay: ignoring '" << line << "'" << endl;
+    }
+    mem_setup(channels);
+    const bool pcie = iio > 0;
+    if (pcie && iio != pcie_raw_size()){
+        cerr << "replay: " << iio << " iio deltas per record, topology has " << pcie_raw_size() << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // everything in memory first, the timing below is the output path only
+    vector<record> records;
+    record r;
+    r.reads.resize(numSockets * channels);
+    r.writes.resize(numSockets * channels);
+    r.iio.resize(iio);
+    while (read_record(in, r))
+        records.push_back(r);
+    in.close();
+
+    std::ofstream file_stream;
+    std::ostream* OUT = &std::cout;
+    if (OUT_FILE.size()>0) {
+        file_stream.open(OUT_FILE.c_str(), std::ios_base::out);
+        OUT = &file_stream;
+    }
+    vector<string> columns = mem_columns(numSockets);
+    if (pcie){
+        vector<string> p = pcie_columns();
+        columns.insert(columns.end(), p.begin(), p.end());
+    }
+    const bool report = stats_setup(result, columns.size());
+    if (writer == "all"){
+        const vector<string> header = report ? stats_columns(columns) : columns;
+        *OUT << "Time";
+        for (auto c = header.cbegin(); c != header.cend(); ++c)
+            *OUT << (OUT_FILE.size()>0 ? "," : "    ") << *c;
+        *OUT << "\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64 rows = 0;
+    vector<double> values, summary;
+    for (int loop = 0; loop < loops; loop++){
+        for (auto rec = records.cbegin(); rec != records.cend(); ++rec){
+            values.clear();
+            mem_rates(numSockets, rec->reads, rec->writes, rec->elapsed_ms, values);
+            if (pcie){
+                pcie_replay(rec->iio, rec->slice_ms);
+                if (writer == "all")
+                    pcie_values(values);
+            }
+            if (writer == "pcie"){
+                pcie_write_csv(*OUT);
+            }else if (!report){
+                write_values(*OUT, formatDateTime(rec->epoch_ms), values, OUT_FILE.size()>0);
+            }else if (stats_add(values, rec->elapsed_ms)){
+                stats_values(summary);
+                write_values(*OUT, formatDateTime(rec->epoch_ms), summary, OUT_FILE.size()>0);
+            }
+            rows++;
+        }
+    }
+    OUT->flush();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    char buf[128];
+    snprintf(buf, sizeof(buf), "replay: %llu intervals in %.3f s, %.0f intervals/s",
+             (unsigned long long)rows, seconds, seconds > 0 ? rows / seconds : 0.0);
+    cerr << buf << endl;
+    file_stream.close();
+    exit(EXIT_SUCCESS);
+}
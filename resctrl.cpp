@@ -0,0 +1,210 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Who is using the bandwidth: resctrl monitoring groups for cgroups, PIDs or
+// groups that already exist, read every interval from
+//   <root>/<group>/mon_data/mon_L3_<id>/{mbm_total_bytes,mbm_local_bytes,llc_occupancy}
+// Groups we create live under <root>/mon_groups/pmt_<name> and are removed at
+// exit, cgroups are re-synced into them every read. The L3 id is the socket
+// on parts without sub-NUMA clustering, so the columns are
+//   <name>_S<id>Total, <name>_S<id>Local (MB/s), <name>_S<id>LLC (MB)
+struct resctrl_group{
+    string name;
+    string dir;         // the resctrl group
+    string cgroup;      // cgroup.procs to follow, empty for pids/existing groups
+    set<int> pids;      // already written to tasks
+    bool created;
+};
+
+static string root = "/sys/fs/resctrl";
+static vector<resctrl_group> groups;
+static vector<string> domains;      // "00", "01" ... from <root>/mon_data
+
+void add_resctrl_options(cxxopts::Options& options){
+    options.add_options("resctrl")
+        ("groups",       "Per group MBM/LLC columns: cgroup paths, PIDs (a+b+c) or resctrl group names, comma separated", cxxopts::value<string>()->default_value(""))
+        ("resctrl-root", "resctrl mount point",  cxxopts::value<string>()->default_value("/sys/fs/resctrl"))
+    ;
+}
+
+static bool is_dir(const string& path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void write_pids(resctrl_group& g, const vector<int>& pids){
+    const string tasks = g.dir + "/tasks";
+    int fd = open(tasks.c_str(), O_WRONLY);
+    if (fd < 0){
+        if (DEBUG) cerr << "resctrl: can't open " << tasks << ": " << strerror(errno) << endl;
+        return;
+    }
+    char buf[32];
+    for (auto p = pids.cbegin(); p != pids.cend(); ++p){
+        if (g.pids.count(*p)) continue;
+        const int n = snprintf(buf, sizeof(buf), "%d\n", *p);
+        // the kernel takes one pid per write, exited ones fail with ESRCH
+        if (write(fd, buf, n) == n)
+            g.pids.insert(*p);
+    }
+    close(fd);
+}
+
+static vector<int> cgroup_pids(const string& cgroup){
+    vector<int> pids;
+    std::ifstream in((cgroup + "/cgroup.procs").c_str());
+    if (!in.is_open())
+        in.open((cgroup + "/tasks").c_str());
+    int pid;
+    while (in >> pid)
+        pids.push_back(pid);
+    return pids;
+}
+
+static void create_group(resctrl_group& g){
+    g.dir = root + "/mon_groups/pmt_" + g.name;
+    if (is_dir(g.dir)){
+        g.created = false;
+        return;
+    }
+    if (mkdir(g.dir.c_str(), 0755) != 0){
+        cerr << "resctrl: can't create " << g.dir << ": " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    g.created = true;
+}
+
+// false when --groups is empty
+bool resctrl_setup(const cxxopts::ParseResult& result){
+    root = result["resctrl-root"].as<string>();
+    stringstream ss(result["groups"].as<string>());
+    string item;
+    while (getline(ss, item, ',')) {
+        if (item.empty()) continue;
+        resctrl_group g;
+        g.created = false;
+        if (item.find_first_not_of("0123456789+") == string::npos){
+            g.name = "pid" + item.substr(0, item.find('+'));
+            create_group(g);
+            vector<int> pids;
+            stringstream ps(item);
+            string pid;
+            while (getline(ps, pid, '+'))
+                if (pid.size()) pids.push_back(atoi(pid.c_str()));
+            write_pids(g, pids);
+        }else if (item.find('/') != string::npos){
+            g.cgroup = item;
+            while (g.cgroup.size() > 1 && g.cgroup[g.cgroup.size() - 1] == '/')
+                g.cgroup.erase(g.cgroup.size() - 1);
+            g.name = g.cgroup.substr(g.cgroup.rfind('/') + 1);
+            create_group(g);
+            write_pids(g, cgroup_pids(g.cgroup));
+        }else{
+            g.name = item;
+            g.dir = is_dir(root + "/mon_groups/" + item) ? root + "/mon_groups/" + item : root + "/" + item;
+            if (!is_dir(g.dir + "/mon_data")){
+                cerr << "resctrl: no group " << item << " under " << root << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        groups.push_back(g);
+    }
+    if (groups.empty()) return false;
+
+    DIR* d = opendir((root + "/mon_data").c_str());
+    if (!d){
+        cerr << "resctrl: " << root << "/mon_data is missing, is resctrl mounted with monitoring?" << endl;
+        exit(EXIT_FAILURE);
+    }
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL)
+        if (strncmp(e->d_name, "mon_L3_", 7) == 0)
+            domains.push_back(e->d_name + 7);
+    closedir(d);
+    std::sort(domains.begin(), domains.end());
+    return true;
+}
+
+vector<string> resctrl_columns(){
+    vector<string> columns;
+    for (auto g = groups.cbegin(); g != groups.cend(); ++g){
+        for (auto d = domains.cbegin(); d != domains.cend(); ++d){
+            const string prefix = g->name + "_S" + std::to_string(atoi(d->c_str()));
+            columns.push_back(prefix + "Total");
+            columns.push_back(prefix + "Local");
+            columns.push_back(prefix + "LLC");
+        }
+    }
+    return columns;
+}
+
+// "Unavailable" and missing files read as 0
+uint64 resctrl_counter(const string& path){
+    char buf[64];
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return 0;
+    const ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = 0;
+    return strtoull(buf, NULL, 10);
+}
+
+// [(group * domains + domain) * 3 + {total, local, llc}]
+void resctrl_read(vector<uint64>& out){
+    out.resize(groups.size() * domains.size() * 3);
+    size_t i = 0;
+    for (auto g = groups.begin(); g != groups.end(); ++g){
+        if (g->cgroup.size())
+            write_pids(*g, cgroup_pids(g->cgroup));
+        for (auto d = domains.cbegin(); d != domains.cend(); ++d){
+            const string dir = g->dir + "/mon_data/mon_L3_" + *d + "/";
+            out[i++] = resctrl_counter(dir + "mbm_total_bytes");
+            out[i++] = resctrl_counter(dir + "mbm_local_bytes");
+            out[i++] = resctrl_counter(dir + "llc_occupancy");
+        }
+    }
+}
+
+// MB/s for the byte counters, MB for the occupancy, in resctrl_columns() order
+void resctrl_values(const vector<uint64>& before, const vector<uint64>& after, const uint64 elapsedTime, vector<double>& values){
+    auto toBW = [&elapsedTime](uint64 b, uint64 a) -> float {
+        if (a < b || elapsedTime == 0) return 0.0f;
+        float val = ((a - b) / 1000000.0 / (elapsedTime / 1000.0));
+        return roundf(val * 100) / 100;
+    };
+    for (size_t i = 0; i + 2 < after.size(); i += 3){
+        const bool have = i + 2 < before.size();
+        values.push_back(have ? toBW(before[i], after[i]) : 0);
+        values.push_back(have ? toBW(before[i + 1], after[i + 1]) : 0);
+        values.push_back(roundf(after[i + 2] / 10000.0) / 100);
+    }
+}
+
+// remove the groups we made, their tasks fall back to the parent group
+void resctrl_cleanup(){
+    for (auto g = groups.cbegin(); g != groups.cend(); ++g)
+        if (g->created && rmdir(g->dir.c_str()) != 0)
+            cerr << "resctrl: can't remove " << g->dir << ": " << strerror(errno) << endl;
+    groups.clear();
+}
@@ -0,0 +1,76 @@
+#include "cpucounters.h"
+#include <string>
+#include <vector>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// One pass of the combined collector: IMC state is read at both ends of the
+// window, iio events (when enabled) are sliced inside it by sampler_wait().
+static bool SAMPLE_PCIE=false;
+static uint32 numSockets=0;
+static imc_state BeforeState, AfterState;
+static uint64 BeforeTime = 0, AfterTime = 0;
+static vector<uint64> channelReads, channelWrites;
+
+void sampler_setup(PCM *m, bool pcie){
+    SAMPLE_PCIE = pcie;
+    numSockets = m->getNumSockets();
+    imc_setup(m);
+    if (SAMPLE_PCIE)
+        pcie_setup(m);
+    sampler_reset(m);
+}
+
+// start a new window now, dropping whatever the old one counted
+void sampler_reset(PCM *m){
+    imc_read(BeforeState);
+    BeforeTime = m->getTickCount();
+}
+
+vector<string> sampler_columns(){
+    vector<string> columns = mem_columns(numSockets);
+    if (SAMPLE_PCIE){
+        vector<string> pcie = pcie_columns();
+        columns.insert(columns.end(), pcie.begin(), pcie.end());
+    }
+    return columns;
+}
+
+void sampler_wait(PCM *m, double seconds){
+    if (SAMPLE_PCIE)
+        pcie_collect(m, seconds);
+    else
+        MySleepMs(int(seconds*1000));
+}
+
+// close the window: values in sampler_columns() order, checked against the
+// alert rules and change-point detectors right away, returns its length in ms
+uint64 sampler_read(PCM *m, vector<double>& values){
+    imc_read(AfterState);
+    AfterTime = m->getTickCount();
+    const uint64 elapsed = AfterTime - BeforeTime;
+
+    values.clear();
+    imc_deltas(BeforeState, AfterState, channelReads, channelWrites);
+    mem_rates(numSockets, channelReads, channelWrites, elapsed, values);
+    if (SAMPLE_PCIE)
+        pcie_values(values);
+    alert_check(values);
+    detect_check(values);
+    swap(BeforeTime, AfterTime);
+    swap(BeforeState, AfterState);
+    return elapsed;
+}
+
+// the raw IMC counts behind the last sampler_read()
+void sampler_raw(vector<uint64>& reads, vector<uint64>& writes){
+    reads = channelReads;
+    writes = channelWrites;
+}
+
+void sampler_cleanup(){
+    BeforeState = imc_state();
+    AfterState = imc_state();
+}
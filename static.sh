@@ -1,9 +1,31 @@
 #cd /data/tools/pmt/
 #yum install glibc-static libstdc++-static
-rm -rf pcie mem 
-g++  main.cpp -o mem  -std=c++11 -Ipcm/src/ -Llib/ -lpcm -lpthread -ldl -static  # libpcm.a
-g++  pcie.cpp -o pcie -std=c++11 -Ipcm/src/ -Llib/ -lpcm -lpthread -ldl -static 
+rm -rf pmt pcie mem bench
+SRC="main.cpp mem.cpp pcie.cpp sampler.cpp daemon.cpp flight.cpp trigger.cpp hires.cpp stats.cpp replay.cpp overhead.cpp core.cpp energy.cpp resctrl.cpp mba.cpp alert.cpp pciscan.cpp ecam.cpp rate.cpp top.cpp detect.cpp"
+g++  $SRC -o pmt -std=c++11 -Ipcm/src/ -Llib/ -lpcm -lpthread -ldl -static  # libpcm.a
+ln -s pmt mem     # pmt mem
+ln -s pmt pcie    # pmt pcie
+g++  $SRC bench.cpp -DPMT_BENCH -o bench -std=c++11 -Ipcm/src/ -Llib/ -lpcm -lpthread -ldl -static  # ./bench > bench.csv, never deployed
 
 
 #ids=`lspci|grep acc|awk '{print $1}'| tr '\n' ','`
 #./pcie --only=$ids
+#./pmt all --only=$ids
+#./pmt daemon -p &  echo "SUBSCRIBE 1000 S0Read,S0Write" | nc -U /run/pmt.sock
+#./mem --latency -c   # bandwidth and RPQ/WPQ latency from the same window
+#./mem -u        # UPI in/out MB/s and utilization next to each socket's Read/Write
+#./mem -e  &&  ./pcie -e   # package/DRAM watts and GB/s per watt per socket
+#./mem --groups /sys/fs/cgroup/batch.slice,1234+1235   # MBM total/local MB/s and LLC MB per group
+#./pmt mem -s 1 -t "S0Read>20000" --fine 0.01 --burst 5
+#./pmt all -c -s 0.1 -r 1    # one row/s of min,mean,max,p50,p99
+#./pmt record -p -n 60 -o box.rec && ./pmt replay -i box.rec -o /dev/null --loops 100
+#./pcie -s 1 --overhead pcie-overhead.csv -n 60   # self cost per interval, jitter histogram at exit
+#./pmt mba --throttle batch --target 60000 --group-target batch=10000   # MBA PI loop, back to 100% at exit
+#./pmt mba --throttle batch,etl --target 40000 --simulate 2 --resctrl-root /tmp/fake-resctrl -s 0.1 -g
+#./mem --alert "S*Read>85% peak=120000 for=3 cooldown=60 do=exec:/usr/local/bin/page-oncall"
+#./pcie --alert "3b:00.0_IBW>10G clear=8G do=fifo:/run/pmt-alerts do=log"   # alert lines: cat /run/pmt-alerts
+#./pmt all -c -s 0.5 --detect "cusum h=6 log=/var/log/pmt-changes"   # channel and device change-point events
+#./pcie --live -k 20 -s 1   # top 20 devices redrawn in place: / filters, s sorts, q quits
+#./pmt core -k 8 --by remote   # sockets plus the 8 cores pulling most remote DRAM
+#./pmt hires -u 100 -n 5 -o burst.bin
+#./pmt flight -p -m 10 --control /run/pmt-flight & kill -USR1 %1  (or: echo dump > /run/pmt-flight)
@@ -0,0 +1,133 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Windowed summaries between the sampler and the writers: each metric keeps
+// Welford moments and a log-linear histogram (HDR style, 32 linear buckets
+// per power of two, ~3% worst case error) of its values at 0.01 resolution.
+// Everything is allocated once, add() is a handful of integer ops.
+static const uint32 SUB_BITS = 5;
+static const uint64 SUB = 1ULL << SUB_BITS;
+static const uint32 MAGNITUDES = 40;
+
+static inline uint32 msb(uint64 x){
+    return 63 - __builtin_clzll(x);
+}
+
+void metric_stats::reset(){
+    n = 0;
+    mean = m2 = 0;
+    min = max = 0;
+    if (hist.empty())
+        hist.assign(SUB * (MAGNITUDES + 1), 0);
+    else
+        std::fill(hist.begin(), hist.end(), 0);
+}
+
+static inline uint32 bucket_of(double v){
+    const uint64 x = v > 0 ? (uint64)(v * 100 + 0.5) : 0;
+    if (x < SUB) return (uint32)x;
+    const uint32 mag = msb(x) - SUB_BITS;
+    if (mag >= MAGNITUDES) return (uint32)(SUB * (MAGNITUDES + 1) - 1);
+    return (uint32)(SUB + mag * SUB + ((x >> mag) - SUB));
+}
+
+// midpoint of a bucket, back in the metric's units
+static inline double bucket_value(uint32 b){
+    if (b < SUB) return b / 100.0;
+    const uint32 mag = (b - SUB) / SUB;
+    const uint64 low = (SUB + (b - SUB) % SUB) << mag;
+    return (low + ((1ULL << mag) - 1) / 2.0) / 100.0;
+}
+
+void metric_stats::add(double v){
+    n++;
+    if (n == 1){
+        min = max = v;
+    }else{
+        min = (std::min)(min, v);
+        max = (std::max)(max, v);
+    }
+    const double d = v - mean;
+    mean += d / n;
+    m2 += d * (v - mean);
+    hist[bucket_of(v)]++;
+}
+
+double metric_stats::stddev() const {
+    return n > 1 ? sqrt(m2 / (n - 1)) : 0;
+}
+
+double metric_stats::percentile(double p) const {
+    if (n == 0) return 0;
+    const uint64 rank = (std::max)((uint64)1, (uint64)ceil(p * n));
+    uint64 seen = 0;
+    for (uint32 b = 0; b < hist.size(); b++){
+        seen += hist[b];
+        if (seen >= rank)
+            return (std::min)(max, (std::max)(min, bucket_value(b)));
+    }
+    return max;
+}
+
+static vector<metric_stats> window;
+static float report_seconds = 0;
+static double window_ms = 0;
+
+void add_stats_options(cxxopts::Options& options){
+    options.add_options("stats")
+        ("r,report", "Seconds/row of min,mean,max,p50,p99 over the samples in it, 0 writes every sample", cxxopts::value<float>()->default_value("0"))
+    ;
+}
+
+bool stats_setup(const cxxopts::ParseResult& result, size_t ncols){
+    report_seconds = result["report"].as<float>();
+    if (report_seconds <= 0) return false;
+    window.assign(ncols, metric_stats());
+    for (auto w = window.begin(); w != window.end(); ++w)
+        w->reset();
+    window_ms = 0;
+    return true;
+}
+
+vector<string> stats_columns(const vector<string>& columns){
+    static const char* names[5] = {"min", "mean", "max", "p50", "p99"};
+    vector<string> out;
+    for (auto c = columns.cbegin(); c != columns.cend(); ++c)
+        for (int i = 0; i < 5; i++)
+            out.push_back(*c + "_" + names[i]);
+    return out;
+}
+
+bool stats_pending(){
+    return window_ms > 0;
+}
+
+// fold one sample in, true when the report window is full
+bool stats_add(const vector<double>& values, uint64 elapsed_ms){
+    for (size_t i = 0; i < values.size() && i < window.size(); i++)
+        window[i].add(values[i]);
+    window_ms += elapsed_ms;
+    return window_ms + elapsed_ms / 2.0 >= report_seconds * 1000;
+}
+
+// the summaries in stats_columns() order, starts the next window
+void stats_values(vector<double>& out){
+    out.clear();
+    for (auto w = window.begin(); w != window.end(); ++w){
+        out.push_back(w->min);
+        out.push_back(w->mean);
+        out.push_back(w->max);
+        out.push_back(w->percentile(0.50));
+        out.push_back(w->percentile(0.99));
+        w->reset();
+    }
+    window_ms = 0;
+}
@@ -0,0 +1,223 @@
+#include "cpucounters.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Live top-N device view of pcie --live: a fixed screen on the terminal's
+// alternate buffer instead of a csv block per interval. Devices are ranked
+// by total or one direction's MB/s with a partial sort, only the shown rows
+// are formatted, and each frame is diffed against the one on the terminal:
+// a changed line costs a cursor move and its changed span, an unchanged line
+// nothing, so a 200 device box over ssh sends a few hundred bytes a frame.
+// Keys are read by a thread and redraw at once with the last values:
+//   /   filter on the device name, Enter applies, Esc drops it
+//   s   next sort column: Total, IBW, IBR, OBR, OBW
+//   q   quit, same as SIGINT
+static const char* sort_names[5] = {"Total", "IBW", "IBR", "OBR", "OBW"};
+static std::mutex top_lock;
+static bool top_active = false;
+static struct termios saved_tty;
+static volatile sig_atomic_t resized = 1;
+static int top_n = 0;
+static int sort_col = 0;
+static bool editing = false;
+static string filter, typing;
+static vector<string> names, lower_names;
+static vector<double> vals;             // 4 per name: IBW, IBR, OBR, OBW
+static string stamp;
+static vector<string> screen;           // what the terminal shows
+static uint32 rows = 24, cols = 80;
+static uint64 frame_bytes = 0;
+
+static void on_winch(int){
+    resized = 1;
+}
+
+static string lower(const string& s){
+    string l = s;
+    for (auto c = l.begin(); c != l.end(); ++c)
+        *c = (char)tolower((unsigned char)*c);
+    return l;
+}
+
+static double key(size_t i){
+    const double* v = &vals[i * 4];
+    return sort_col == 0 ? v[0] + v[1] + v[2] + v[3] : v[sort_col - 1];
+}
+
+static string fit(const string& s){
+    return s.size() >= cols ? s.substr(0, cols) : s + string(cols - s.size(), ' ');
+}
+
+// frame from the current state, then only its differences go out; caller holds top_lock
+static void render(){
+    string out;
+    if (resized){
+        resized = 0;
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 3 && ws.ws_col > 40){
+            rows = ws.ws_row;
+            cols = ws.ws_col;
+        }
+        screen.assign(rows, string(cols, ' '));
+        out += "\x1b[2J";
+    }
+    const size_t n = vals.size() / 4 < names.size() ? vals.size() / 4 : names.size();
+    vector<size_t> match;
+    const string f = lower(filter);
+    for (size_t i = 0; i < n; i++)
+        if (f.empty() || lower_names[i].find(f) != string::npos) match.push_back(i);
+    const size_t room = rows - 3;
+    const size_t shown = (std::min)(match.size(), top_n > 0 ? (std::min)((size_t)top_n, room) : room);
+    std::partial_sort(match.begin(), match.begin() + shown, match.end(), [](size_t a, size_t b){
+        const double ka = key(a), kb = key(b);
+        return ka != kb ? ka > kb : a < b;
+    });
+
+    vector<string> frame(rows);
+    char buf[512];
+    snprintf(buf, sizeof(buf), "pmt pcie  %s  %zu/%zu devices  sort: %s  filter: %s  last frame: %llu B",
+             stamp.c_str(), shown, match.size(), sort_names[sort_col], filter.empty() ? "-" : filter.c_str(),
+             (unsigned long long)frame_bytes);
+    frame[0] = buf;
+    const int name_w = (int)cols - 56 > 10 ? (int)cols - 56 : 10;
+    snprintf(buf, sizeof(buf), "%-*s %10s %10s %10s %10s %10s", name_w, "Device", "Total", "IBW", "IBR", "OBR", "OBW");
+    frame[1] = buf;
+    for (size_t r = 0; r < shown; r++){
+        const size_t i = match[r];
+        const double* v = &vals[i * 4];
+        snprintf(buf, sizeof(buf), "%-*.*s %10.2f %10.2f %10.2f %10.2f %10.2f", name_w, name_w, names[i].c_str(),
+                 v[0] + v[1] + v[2] + v[3], v[0], v[1], v[2], v[3]);
+        frame[2 + r] = buf;
+    }
+    frame[rows - 1] = editing ? "/" + typing : "/ filter  s sort  q quit";
+    for (uint32 r = 0; r < rows; r++){
+        const string line = fit(frame[r]);
+        string& old = screen[r];
+        size_t first = 0, last = cols;
+        while (first < cols && line[first] == old[first]) first++;
+        if (first == cols) continue;
+        while (last > first && line[last - 1] == old[last - 1]) last--;
+        snprintf(buf, sizeof(buf), "\x1b[%u;%zuH", r + 1, first + 1);
+        out += buf;
+        out.append(line, first, last - first);
+        old = line;
+    }
+    if (editing){
+        snprintf(buf, sizeof(buf), "\x1b[%u;%zuH\x1b[?25h", rows, (std::min)((size_t)cols, typing.size() + 2));
+        out += buf;
+    }else{
+        out += "\x1b[?25l";
+    }
+    frame_bytes = out.size();
+    for (size_t done = 0; done < out.size(); ){
+        const ssize_t w = write(STDOUT_FILENO, out.data() + done, out.size() - done);
+        if (w <= 0) break;
+        done += (size_t)w;
+    }
+}
+
+static void handle_key(char c){
+    if (editing){
+        if (c == '\r' || c == '\n'){
+            filter = typing;
+            editing = false;
+        }else if (c == 0x1b){
+            filter.clear();
+            typing.clear();
+            editing = false;
+        }else if (c == 0x7f || c == '\b'){
+            if (typing.size()) typing.erase(typing.size() - 1);
+        }else if (isprint((unsigned char)c)){
+            typing += c;
+        }
+        return;
+    }
+    if (c == 'q') STOP = 1;
+    else if (c == 's') sort_col = (sort_col + 1) % 5;
+    else if (c == '/'){
+        editing = true;
+        typing = filter;
+    }
+}
+
+static void read_keys(){
+    for (;;){
+        struct pollfd p = {STDIN_FILENO, POLLIN, 0};
+        const int ready = poll(&p, 1, 100);
+        std::lock_guard<std::mutex> g(top_lock);
+        if (!top_active) return;
+        if (ready > 0){
+            char k[16];
+            const ssize_t len = read(STDIN_FILENO, k, sizeof(k));
+            // escape sequences (arrows) are dropped, anything else key by key
+            for (ssize_t i = 0; i < len && !(len > 1 && k[0] == 0x1b); i++)
+                handle_key(k[i]);
+            render();
+        }else if (resized){
+            render();
+        }
+    }
+}
+
+static void restore(){
+    if (!top_active) return;
+    top_active = false;
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_tty);
+    const char* leave = "\x1b[?25h\x1b[?1049l";
+    if (write(STDOUT_FILENO, leave, strlen(leave)) < 0){}
+}
+
+// n rows at most, 0 fits the screen; names are fixed for the run
+void top_setup(int n, const vector<string>& device_names){
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)){
+        cerr << "pcie: --live needs a terminal" << endl;
+        exit(EXIT_FAILURE);
+    }
+    top_n = n;
+    names = device_names;
+    lower_names.clear();
+    for (auto s = names.cbegin(); s != names.cend(); ++s)
+        lower_names.push_back(lower(*s));
+    tcgetattr(STDIN_FILENO, &saved_tty);
+    struct termios raw = saved_tty;
+    raw.c_lflag &= ~(ICANON | ECHO);            // ISIG stays: ^C still raises STOP
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    signal(SIGWINCH, on_winch);
+    const char* enter = "\x1b[?1049h\x1b[?25l";
+    if (write(STDOUT_FILENO, enter, strlen(enter)) < 0){}
+    top_active = true;
+    atexit([](){ std::lock_guard<std::mutex> g(top_lock); restore(); });
+    std::thread(read_keys).detach();
+}
+
+// one interval's IBW, IBR, OBR, OBW per device, in top_setup() order
+void top_update(const vector<double>& values, const string& time){
+    std::lock_guard<std::mutex> g(top_lock);
+    vals = values;
+    stamp = time;
+    render();
+}
+
+void top_cleanup(){
+    std::lock_guard<std::mutex> g(top_lock);
+    restore();
+}
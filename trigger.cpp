@@ -0,0 +1,94 @@
+#include "cpucounters.h"
+#include "cxxopts.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+#include "pmt.h"
+
+using namespace std;
+using namespace pcm;
+
+// Burst sampling: run at the coarse --delay until a rule such as "S0Read>20000"
+// or "S1_3b:00.0_IBW>8000" holds, then switch to --fine for --burst seconds.
+// A rule still holding at the end of the window re-arms it.
+struct trigger_rule{
+    string metric;
+    int idx;
+    bool above;
+    double threshold;
+};
+
+static vector<trigger_rule> rules;
+static float fine_delay = 0.01;
+static float burst_seconds = 5;
+static std::chrono::steady_clock::time_point burst_until;
+static bool in_burst = false;
+
+void add_trigger_options(cxxopts::Options& options){
+    options.add_options("trigger")
+        ("t,trigger", "Switch to --fine when metric>value or metric<value, comma separated", cxxopts::value<string>()->default_value(""))
+        ("fine",      "Seconds/update while triggered", cxxopts::value<float>()->default_value("0.01"))
+        ("burst",     "Seconds to stay at --fine",      cxxopts::value<float>()->default_value("5"))
+    ;
+}
+
+// min_delay: the shortest interval the collector can sample, an explicit
+// --fine below it is an error, the default is raised to it
+void trigger_setup(const cxxopts::ParseResult& result, const vector<string>& columns, float min_delay){
+    fine_delay = result["fine"].as<float>();
+    if (fine_delay < min_delay){
+        if (result.count("fine")){
+            cerr << "trigger: --fine " << fine_delay << " is below " << min_delay << "s, 1 ms per pcie event" << endl;
+            exit(EXIT_FAILURE);
+        }
+        fine_delay = min_delay;
+    }
+    burst_seconds = result["burst"].as<float>();
+    stringstream ss(result["trigger"].as<string>());
+    string item;
+    while (getline(ss, item, ',')) {
+        size_t op = item.find_first_of("<>");
+        if (op == string::npos || op == 0){
+            cerr << "trigger: expected metric>value or metric<value, got " << item << endl;
+            exit(EXIT_FAILURE);
+        }
+        trigger_rule r;
+        r.metric = item.substr(0, op);
+        r.above = item[op] == '>';
+        r.threshold = atof(item.substr(op + 1).c_str());
+        auto it = std::find(columns.begin(), columns.end(), r.metric);
+        if (it == columns.end()){
+            cerr << "trigger: unknown metric " << r.metric << endl;
+            exit(EXIT_FAILURE);
+        }
+        r.idx = (int)(it - columns.begin());
+        rules.push_back(r);
+    }
+}
+
+// interval to sleep before the next sample, given the values just written
+float trigger_interval(const vector<double>& values, float coarse){
+    if (rules.empty()) return coarse;
+    auto now = std::chrono::steady_clock::now();
+    for (auto r = rules.cbegin(); r != rules.cend(); ++r) {
+        if (r->idx >= (int)values.size()) continue;
+        const double v = values[r->idx];
+        if (r->above ? v > r->threshold : v < r->threshold){
+            if (!in_burst && DEBUG)
+                cerr << currentDateTime() << " trigger " << r->metric << "=" << v << ", sampling every " << fine_delay << "s" << endl;
+            in_burst = true;
+            burst_until = now + std::chrono::milliseconds((long long)(burst_seconds * 1000));
+            break;
+        }
+    }
+    if (in_burst && now >= burst_until){
+        in_burst = false;
+        if (DEBUG)
+            cerr << currentDateTime() << " trigger released, sampling every " << coarse << "s" << endl;
+    }
+    return in_burst ? fine_delay : coarse;
+}